@@ -1,7 +1,9 @@
 #include <iostream>
+#include <memory>
 #include <string>
 #include "src/selector.h"
 #include "src/config.h"
+#include "src/options.h"
 
 inline std::pair<size_t, size_t> parse_grid_size(const std::string& size_str) {
     if(size_str.size() < 5 || size_str[0] != 'S' || size_str[1] != '(') {
@@ -30,15 +32,45 @@ inline std::string get_arg(int argc, char** argv,
     return std::string(default_val);
 }
 
+inline bool has_flag(int argc, char** argv, std::string_view flag) {
+    for(int i = 1; i < argc; ++i) {
+        if(argv[i] == flag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline FlowSolver parse_flow_solver(const std::string& name) {
+    if(name == "reference") {
+        return FlowSolver::Reference;
+    }
+    if(name == "dinic") {
+        return FlowSolver::Dinic;
+    }
+    throw std::runtime_error("Unknown flow solver: " + name);
+}
+
+inline Kernel parse_kernel(const std::string& name) {
+    if(name == "scalar") {
+        return Kernel::Scalar;
+    }
+    if(name == "simd") {
+        return Kernel::Simd;
+    }
+    throw std::runtime_error("Unknown kernel: " + name);
+}
+
 void start_simulation(const std::string& p_type, const std::string& v_type,
-                      const std::string& v_flow_type, size_t n, size_t m) {
+                      const std::string& v_flow_type, size_t n, size_t m,
+                      const SimulationOptions& opts) {
     #define S(N, M) N, M
 
     using CompileTypes = NumericTypeSet<TYPES>;
     using CompileSizes = GridSizeSet<SIZES>;
 
     if(!create_simulator<CompileTypes, CompileSizes>(
-        p_type, v_type, v_flow_type, n, m)) {
+        p_type, v_type, v_flow_type, n, m, opts)) {
         std::cerr << "Failed to create simulator\n";
         exit(1);
     }
@@ -50,15 +82,52 @@ int main(int argc, char** argv) {
         std::string v_type = get_arg(argc, argv, "--v-type", "FIXED(31,17)");
         std::string v_flow_type = get_arg(argc, argv, "--v-flow-type", "DOUBLE");
         std::string grid_size = get_arg(argc, argv, "--size", "S(36,84)");
+        std::string scenario_file = get_arg(argc, argv, "--scenario", "");
 
         auto [n, m] = parse_grid_size(grid_size);
 
+        // A scenario fixes the grid size; an explicit --size must agree.
+        std::unique_ptr<Scenario> scenario;
+        if(!scenario_file.empty()) {
+            scenario = std::make_unique<Scenario>(scenario_file);
+            if(has_flag(argc, argv, "--size") && (n != scenario->rows || m != scenario->cols)) {
+                throw std::runtime_error("--size " + grid_size + " does not match the " +
+                                         std::to_string(scenario->rows) + "x" +
+                                         std::to_string(scenario->cols) + " scenario");
+            }
+            n = scenario->rows;
+            m = scenario->cols;
+        }
+
+        SimulationOptions opts;
+        opts.threads = std::stoull(get_arg(argc, argv, "--threads", "1"));
+        opts.parallel_move = has_flag(argc, argv, "--parallel-move");
+        opts.seed = std::stoull(get_arg(argc, argv, "--seed", "1"));
+        opts.huge_pages = has_flag(argc, argv, "--huge-pages");
+        opts.sparse = has_flag(argc, argv, "--sparse");
+        opts.verify_sparse = has_flag(argc, argv, "--verify-sparse");
+        opts.flow_solver = parse_flow_solver(get_arg(argc, argv, "--flow-solver", "reference"));
+        opts.flow_worklist = has_flag(argc, argv, "--flow-worklist");
+        opts.kernel = parse_kernel(get_arg(argc, argv, "--kernel", "scalar"));
+        opts.render_every = has_flag(argc, argv, "--no-render")
+                                ? 0 : std::stoull(get_arg(argc, argv, "--render-every", "1"));
+        opts.render_async = has_flag(argc, argv, "--render-async");
+        opts.trajectory = get_arg(argc, argv, "--trajectory", "");
+        opts.trajectory_p = has_flag(argc, argv, "--trajectory-p");
+        opts.trajectory_velocity = has_flag(argc, argv, "--trajectory-velocity");
+        opts.keyframe_every = std::stoull(get_arg(argc, argv, "--keyframe-every", "256"));
+        opts.ticks = std::stoull(get_arg(argc, argv, "--ticks", "500"));
+        opts.save_interval = std::stoull(get_arg(argc, argv, "--save-interval", "0"));
+        opts.checkpoint = get_arg(argc, argv, "--checkpoint", "checkpoint.bin");
+        opts.resume = get_arg(argc, argv, "--resume", "");
+        opts.scenario = scenario.get();
+
         using CompileTypes = NumericTypeSet<TYPES>;
 
         using CompileSizes = GridSizeSet<SIZES>;
 
         if(!create_simulator<CompileTypes, CompileSizes>(
-            p_type, v_type, v_flow_type, n, m)) {
+            p_type, v_type, v_flow_type, n, m, opts)) {
             std::cerr << "Failed to create simulator\n";
             return 1;
         }
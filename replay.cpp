@@ -0,0 +1,99 @@
+#include <iostream>
+#include <string>
+#include "src/frame_output.h"
+#include "src/trajectory.h"
+
+// Renders a trajectory written with --trajectory, without re-simulating.
+//   fluid_replay FILE [--tick T | --from A --to B] [--every K] [--info]
+// --tick prints the state at tick T (the last record at or before it);
+// otherwise every K-th record in [A, B] is printed. --info prints the
+// header and record statistics to stderr instead of frames.
+
+inline std::string get_arg(int argc, char** argv,
+                          std::string_view param,
+                          std::string_view default_val) {
+    for(int i = 1; i < argc - 1; ++i) {
+        if(argv[i] == param) {
+            return argv[i + 1];
+        }
+    }
+    return std::string(default_val);
+}
+
+inline bool has_flag(int argc, char** argv, std::string_view flag) {
+    for(int i = 1; i < argc; ++i) {
+        if(argv[i] == flag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void print_info(const trajectory::Reader &reader) {
+    auto &h = reader.format();
+    auto &records = reader.records();
+    size_t keyframes = 0, bytes = 0;
+    for(auto &e : records) {
+        keyframes += e.kind == trajectory::Keyframe;
+        bytes += e.size;
+    }
+    std::cerr << "Grid: " << h.n << "x" << h.m << "\n"
+              << "Planes: field" << (h.planes & trajectory::Pressure ? " p" : "")
+              << (h.planes & trajectory::Velocity ? " velocity" : "") << "\n"
+              << "Records: " << records.size() << " (" << keyframes << " keyframes)\n"
+              << "Payload: " << bytes << " bytes, raw state " << records.size() * h.state_size() << " bytes\n";
+    if(!records.empty())
+        std::cerr << "Ticks: " << records.front().tick << ".." << records.back().tick << "\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        if(argc < 2) {
+            std::cerr << "Usage: fluid_replay FILE [--tick T | --from A --to B] [--every K] [--info]\n";
+            return 1;
+        }
+
+        trajectory::Reader reader(argv[1]);
+        if(has_flag(argc, argv, "--info")) {
+            print_info(reader);
+            return 0;
+        }
+
+        auto &h = reader.format();
+        FrameWriter frames;
+        auto render = [&] {
+            frames.frame(h.n, h.m, [&](size_t x, size_t y) {
+                return reader.symbol(x, y);
+            });
+        };
+
+        std::string tick = get_arg(argc, argv, "--tick", "");
+        if(!tick.empty()) {
+            if(!reader.seek(std::stoull(tick))) {
+                std::cerr << "No record at or before tick " << tick << "\n";
+                return 1;
+            }
+            render();
+            return 0;
+        }
+
+        uint64_t from = std::stoull(get_arg(argc, argv, "--from", "0"));
+        uint64_t to = std::stoull(get_arg(argc, argv, "--to", std::to_string(UINT64_MAX)));
+        size_t every = std::max<size_t>(1, std::stoull(get_arg(argc, argv, "--every", "1")));
+        auto &records = reader.records();
+        size_t shown = 0;
+        for(size_t i = 0; i < records.size(); ++i) {
+            if(records[i].tick < from || records[i].tick > to)
+                continue;
+            if(shown++ % every != 0)
+                continue;
+            reader.decode(i);
+            render();
+        }
+        return 0;
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
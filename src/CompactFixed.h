@@ -0,0 +1,121 @@
+#pragma once
+
+#include "FastFixed.h"
+
+// Storage-only N-bit value with K fractional bits, kept in the smallest
+// integer that holds N bits. Arithmetic loads both sides into Wide, a
+// FastFixed<2N, K>, and returns the Wide result; assigning back narrows with
+// saturation. Meant for velocity and velocity_flow, where halving the field
+// width matters more than the precision of the stored value.
+template <size_t N, size_t K>
+class CompactFixed {
+public:
+    static_assert(N <= 32 && K < N);
+
+    using RawType = conditional_t<N <= 8, int8_t,
+                    conditional_t<N <= 16, int16_t, int32_t>>;
+    using Wide = FastFixed<2 * N, K>;
+    static constexpr size_t Bits = N;
+    static constexpr size_t Fraction = K;
+    static constexpr double scale = static_cast<double>(uint64_t(1) << K);
+    RawType v;
+
+    constexpr CompactFixed(int val) : v(numeric_cast<CompactFixed>(Wide(val)).v) {}
+    constexpr CompactFixed() : v(0) {}
+
+    template <typename OTHER>
+    constexpr CompactFixed(OTHER x) : v(numeric_cast<CompactFixed>(x).v) {}
+
+    static constexpr CompactFixed from_raw(RawType raw) {
+        CompactFixed tmp;
+        tmp.v = raw;
+        return tmp;
+    }
+
+    constexpr Wide wide() const {
+        return Wide::from_raw(v);
+    }
+
+    auto operator<=>(const CompactFixed &) const = default;
+    bool operator==(const CompactFixed &) const = default;
+
+    template <typename OTHER>
+    CompactFixed& operator=(OTHER x) {
+        v = numeric_cast<CompactFixed>(x).v;
+        return *this;
+    }
+
+    explicit operator float() const {
+        return numeric_cast<float>(*this);
+    }
+
+    explicit operator double() const {
+        return numeric_cast<double>(*this);
+    }
+
+    template <typename IntType, typename = enable_if_t<is_integral_v<IntType>>>
+    explicit operator IntType() const {
+        return static_cast<IntType>(v >> K);
+    }
+
+    constexpr Wide operator+(const CompactFixed &other) const {
+        return wide() + other.wide();
+    }
+
+    constexpr Wide operator-(const CompactFixed &other) const {
+        return wide() - other.wide();
+    }
+
+    constexpr Wide operator*(const CompactFixed &other) const {
+        return wide() * other.wide();
+    }
+
+    constexpr Wide operator/(const CompactFixed &other) const {
+        return wide() / other.wide();
+    }
+
+    template <typename OTHER>
+    CompactFixed& operator+=(OTHER rhs) {
+        return *this = wide() + Wide(rhs);
+    }
+
+    template <typename OTHER>
+    CompactFixed& operator-=(OTHER rhs) {
+        return *this = wide() - Wide(rhs);
+    }
+
+    template <typename OTHER>
+    CompactFixed& operator*=(OTHER rhs) {
+        return *this = wide() * Wide(rhs);
+    }
+
+    template <typename OTHER>
+    CompactFixed& operator/=(OTHER rhs) {
+        return *this = wide() / Wide(rhs);
+    }
+
+    friend ostream& operator<<(ostream &os, const CompactFixed &val) {
+        os << static_cast<double>(val);
+        return os;
+    }
+};
+
+template <size_t N, size_t K, typename OTHER>
+typename CompactFixed<N, K>::Wide operator+(const CompactFixed<N, K>& a, OTHER b) {
+    return a.wide() + b;
+}
+
+template <size_t N, size_t K, typename OTHER>
+typename CompactFixed<N, K>::Wide operator-(const CompactFixed<N, K>& a, OTHER b) {
+    return a.wide() - b;
+}
+
+template <size_t N, size_t K, typename OTHER>
+typename CompactFixed<N, K>::Wide operator*(const CompactFixed<N, K>& a, OTHER b) {
+    return a.wide() * b;
+}
+
+template <size_t N, size_t K, typename OTHER>
+typename CompactFixed<N, K>::Wide operator/(const CompactFixed<N, K>& a, OTHER b) {
+    return a.wide() / b;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Types.h"
+#include "convert.h"
 
 using namespace std;
 
@@ -11,7 +12,7 @@ class Double {
         constexpr Double(double f) : v(f) {}
         constexpr Double() : v(0) {}
 
-        template <typename OTHER> constexpr Double(OTHER x) : v(to_double(x)) {}
+        template <typename OTHER> constexpr Double(OTHER x) : v(numeric_cast<double>(x)) {}
 
         double v;
 
@@ -19,16 +20,16 @@ class Double {
         bool operator==(const Double &) const = default;
 
         template <typename OTHER> Double &operator=(OTHER x) {
-            v = to_double(x);
+            v = numeric_cast<double>(x);
             return *this;
         }
 
         template <typename OTHER> auto operator<=>(OTHER x) const {
-            return v <=> to_double(x);
+            return v <=> numeric_cast<double>(x);
         }
 
         template <typename OTHER> bool operator==(OTHER x) const {
-            return v == to_double(x);
+            return v == numeric_cast<double>(x);
         }
 
         static constexpr Double get_epsilon() {
@@ -39,11 +40,12 @@ class Double {
             return Double(std::numeric_limits<double>::max());
         }
 
-        static Double random01() {
-            uint64_t r = rand()%1'000'000'000;
-            if (r < 0)
-                r = -r;
-            return Double((double)r / 1'000'000'000);
+        static constexpr Double from_unit_bits(uint64_t bits) {
+            return Double(static_cast<double>(bits >> 11) * 0x1.0p-53);
+        }
+
+        template <typename Rng> static Double random01(Rng &rng) {
+            return from_unit_bits(rng());
         }
 };
 
@@ -52,7 +54,7 @@ double to_double(Double x) {
 }
 
 template <typename OTHER> Double operator+(Double a, OTHER b) {
-    return a + Double(to_double(b));
+    return a + numeric_cast<Double>(b);
 }
 
 template<>
@@ -65,7 +67,7 @@ Double operator-(Double x) {
 }
 
 template <typename OTHER> Double operator-(Double a, OTHER b) {
-    return a - Double(to_double(b));
+    return a - numeric_cast<Double>(b);
 }
 
 template<>
@@ -74,7 +76,7 @@ Double operator-(Double a, Double b) {
 }
 
 template <typename OTHER> Double operator*(Double a, OTHER b) {
-    return a * Double(to_double(b));
+    return a * numeric_cast<Double>(b);
 }
 
 template<>
@@ -83,7 +85,7 @@ Double operator*(Double a, Double b) {
 }
 
 template <typename OTHER> Double operator/(Double a, OTHER b) {
-    return a / Double(to_double(b));
+    return a / numeric_cast<Double>(b);
 }
 
 template<>
@@ -92,7 +94,7 @@ Double operator/(Double a, Double b) {
 }
 
 template <typename OTHER> Double &operator+=(Double &a, OTHER b) {
-    return a = a + Double(to_double(b));
+    return a = a + numeric_cast<Double>(b);
 }
 
 template<>
@@ -101,7 +103,7 @@ Double &operator+=(Double &a, Double b) {
 }
 
 template <typename OTHER> Double &operator-=(Double &a, OTHER b) {
-    return a = a - Double(to_double(b));
+    return a = a - numeric_cast<Double>(b);
 }
 
 template<>
@@ -110,7 +112,7 @@ Double &operator-=(Double &a, Double b) {
 }
 
 template <typename OTHER> Double &operator*=(Double &a, OTHER b) {
-    return a = a * Double(to_double(b));
+    return a = a * numeric_cast<Double>(b);
 }
 
 template<>
@@ -119,7 +121,7 @@ Double &operator*=(Double &a, Double b) {
 }
 
 template <typename OTHER> Double &operator/=(Double &a, OTHER b) {
-    return a = a / Double(to_double(b));
+    return a = a / numeric_cast<Double>(b);
 }
 
 template<>
@@ -2,28 +2,128 @@
 
 #include "Fixed.h"
 
+// Same value range and scale as Fixed<N, K>, but stored in the fastest
+// integer type that holds N bits. The product and the shifted dividend of
+// two N-bit values need 2N bits, so they go through int64_t up to N = 32
+// and __int128 beyond.
 template <size_t N, size_t K>
-class FastFixed : public Fixed<N, K> {
+class FastFixed {
 public:
-    FastFixed() : Fixed<N, K>() {}
+    using RawType = conditional_t<N <= 8, int_fast8_t,
+                    conditional_t<N <= 16, int_fast16_t,
+                    conditional_t<N <= 32, int_fast32_t, int_fast64_t>>>;
+    using Intermediate = conditional_t<N <= 32, int64_t, __int128>;
+    static constexpr size_t Bits = N;
+    static constexpr size_t Fraction = K;
+    static constexpr double scale = static_cast<double>(uint64_t(1) << K);
+    RawType v;
 
-    FastFixed(int val) : Fixed<N, K>(val) {}
+    constexpr FastFixed(int val) : v(static_cast<RawType>(val) << K) {}
+    constexpr FastFixed(float f) : v(static_cast<RawType>(f * scale)) {}
+    constexpr FastFixed(double d) : v(static_cast<RawType>(d * scale)) {}
+    constexpr FastFixed() : v(0) {}
 
-    FastFixed(float f) : Fixed<N, K>(f) {}
+    constexpr FastFixed(const Fixed<N, K> &other) : v(other.v) {}
 
-    FastFixed(double d) : Fixed<N, K>(d) {}
+    template <typename OTHER>
+    constexpr FastFixed(OTHER x) : v(numeric_cast<FastFixed>(x).v) {}
 
-    FastFixed(const Fixed<N, K>& other) : Fixed<N, K>(other) {}
+    static constexpr FastFixed from_raw(RawType raw) {
+        FastFixed tmp;
+        tmp.v = raw;
+        return tmp;
+    }
+
+    static constexpr FastFixed from_unit_bits(uint64_t bits) {
+        return from_raw(static_cast<RawType>(bits >> (64 - K)));
+    }
+
+    auto operator<=>(const FastFixed &) const = default;
+    bool operator==(const FastFixed &) const = default;
+
+    template <typename OTHER>
+    FastFixed& operator=(OTHER x) {
+        v = numeric_cast<FastFixed>(x).v;
+        return *this;
+    }
+
+    FastFixed& operator=(const Fixed<N, K> &other) {
+        v = other.v;
+        return *this;
+    }
+
+    explicit operator float() const {
+        return numeric_cast<float>(*this);
+    }
+
+    explicit operator double() const {
+        return numeric_cast<double>(*this);
+    }
+
+    template <typename IntType, typename = enable_if_t<is_integral_v<IntType>>>
+    explicit operator IntType() const {
+        return static_cast<IntType>(v >> K);
+    }
+
+    constexpr FastFixed operator+(const FastFixed &other) const {
+        return from_raw(v + other.v);
+    }
 
-    FastFixed(const FastFixed<N, K>& other) : Fixed<N, K>(other) {}
+    constexpr FastFixed operator-(const FastFixed &other) const {
+        return from_raw(v - other.v);
+    }
 
-    FastFixed& operator=(const Fixed<N, K>& other) {
-        Fixed<N, K>::operator=(other);
+    constexpr FastFixed operator*(const FastFixed &other) const {
+        return from_raw(static_cast<RawType>((static_cast<Intermediate>(v) * other.v) >> K));
+    }
+
+    constexpr FastFixed operator/(const FastFixed &other) const {
+        return from_raw(static_cast<RawType>((static_cast<Intermediate>(v) << K) / other.v));
+    }
+
+    FastFixed& operator+=(const FastFixed &rhs) {
+        v += rhs.v;
         return *this;
     }
 
-    FastFixed& operator=(const FastFixed<N, K>& other) {
-        Fixed<N, K>::operator=(other);
+    FastFixed& operator-=(const FastFixed &rhs) {
+        v -= rhs.v;
         return *this;
     }
+
+    FastFixed& operator*=(const FastFixed &rhs) {
+        return *this = *this * rhs;
+    }
+
+    FastFixed& operator/=(const FastFixed &rhs) {
+        return *this = *this / rhs;
+    }
+
+    friend ostream& operator<<(ostream &os, const FastFixed &val) {
+        os << static_cast<double>(val);
+        return os;
+    }
 };
+
+template <size_t S, size_t K>
+constexpr Fixed<S, K>::Fixed(const FastFixed<S, K> &other) : v(static_cast<RawType>(other.v)) {}
+
+template <size_t N, size_t K, typename OTHER>
+FastFixed<N, K> operator+(const FastFixed<N, K>& a, OTHER b) {
+    return a + FastFixed<N, K>(b);
+}
+
+template <size_t N, size_t K, typename OTHER>
+FastFixed<N, K> operator-(const FastFixed<N, K>& a, OTHER b) {
+    return a - FastFixed<N, K>(b);
+}
+
+template <size_t N, size_t K, typename OTHER>
+FastFixed<N, K> operator*(const FastFixed<N, K>& a, OTHER b) {
+    return a * FastFixed<N, K>(b);
+}
+
+template <size_t N, size_t K, typename OTHER>
+FastFixed<N, K> operator/(const FastFixed<N, K>& a, OTHER b) {
+    return a / FastFixed<N, K>(b);
+}
@@ -4,23 +4,31 @@
 #include <iostream>
 #include <type_traits>
 
+#include "convert.h"
+
 using namespace std;
 
+// S-bit signed value with K fractional bits.
 template <size_t S, size_t K>
 class Fixed {
 public:
     using RawType = std::conditional_t<S <= 32, int32_t, int64_t>;
     static constexpr size_t Bits = S;
     static constexpr size_t Fraction = K;
+    static constexpr double scale = static_cast<double>(uint64_t(1) << K);
     RawType v;
 
-    constexpr Fixed(int val) : v(val << S) {}
-    constexpr Fixed(float f) : v(static_cast<RawType>(f * (1 << S))) {}
-    constexpr Fixed(double d) : v(static_cast<RawType>(d * (1 << S))) {}
+    constexpr Fixed(int val) : v(static_cast<RawType>(val) << K) {}
+    constexpr Fixed(float f) : v(static_cast<RawType>(f * scale)) {}
+    constexpr Fixed(double d) : v(static_cast<RawType>(d * scale)) {}
     constexpr Fixed() : v(0) {}
 
+    // Same layout as FastFixed<S, K>, so this is a copy of the raw bits.
+    // Defined in FastFixed.h.
+    constexpr Fixed(const FastFixed<S, K> &other);
+
     template <typename OTHER>
-    constexpr Fixed(OTHER x) : v(static_cast<RawType>(x * (1 << S))) {}
+    constexpr Fixed(OTHER x) : v(numeric_cast<Fixed>(x).v) {}
 
     static constexpr Fixed from_raw(RawType raw) {
         Fixed tmp;
@@ -28,26 +36,31 @@ public:
         return tmp;
     }
 
+    // Maps the top bits of a 64-bit random word onto [0, 1).
+    static constexpr Fixed from_unit_bits(uint64_t bits) {
+        return from_raw(static_cast<RawType>(bits >> (64 - K)));
+    }
+
     auto operator<=>(const Fixed &) const = default;
     bool operator==(const Fixed &) const = default;
 
     template <typename OTHER>
     Fixed& operator=(OTHER x) {
-        v = static_cast<RawType>(x * (1 << S));
+        v = numeric_cast<Fixed>(x).v;
         return *this;
     }
 
     explicit operator float() const {
-        return static_cast<float>(v) / (1 << S);
+        return numeric_cast<float>(*this);
     }
 
     explicit operator double() const {
-        return static_cast<double>(v) / (1 << S);
+        return numeric_cast<double>(*this);
     }
 
     template <typename IntType, typename = enable_if_t<is_integral_v<IntType>>>
     explicit operator IntType() const {
-        return static_cast<IntType>(v >> S);
+        return static_cast<IntType>(v >> K);
     }
 
     Fixed operator+(const Fixed& other) const {
@@ -66,13 +79,13 @@ public:
         using Intermediate = int64_t;
         Intermediate product = static_cast<Intermediate>(v) * static_cast<Intermediate>(other.v);
         Fixed tmp;
-        tmp.v = static_cast<RawType>(product >> S);
+        tmp.v = static_cast<RawType>(product >> K);
         return tmp;
     }
 
     Fixed operator/(const Fixed& other) const {
         using Intermediate = int64_t;
-        Intermediate divRes = (static_cast<Intermediate>(v) << S) / other.v;
+        Intermediate divRes = (static_cast<Intermediate>(v) << K) / other.v;
         Fixed tmp;
         tmp.v = static_cast<RawType>(divRes);
         return tmp;
@@ -3,6 +3,7 @@
 #include <limits>
 
 #include "Types.h"
+#include "convert.h"
 
 using namespace std;
 
@@ -13,7 +14,7 @@ public:
     constexpr Float(double f) : v(static_cast<float>(f)) {}
     constexpr Float() : v(0) {}
 
-        template <typename OTHER> constexpr Float(OTHER x) : v(to_double(x)) {}
+        template <typename OTHER> constexpr Float(OTHER x) : v(numeric_cast<float>(x)) {}
 
         float v;
 
@@ -21,16 +22,16 @@ public:
         bool operator==(const Float &) const = default;
 
         template <typename OTHER> Float &operator=(OTHER x)    {
-                v = to_double(x);
+                v = numeric_cast<float>(x);
                 return *this;
         }
 
         template <typename OTHER> auto operator<=>(OTHER x) const {
-                return v <=> to_double(x);
+                return v <=> numeric_cast<float>(x);
         }
 
         template <typename OTHER> bool operator==(OTHER x) const {
-                return v == to_double(x);
+                return v == numeric_cast<float>(x);
         }
 
         static constexpr Float get_epsilon() {
@@ -41,11 +42,12 @@ public:
                 return Float(std::numeric_limits<float>::max());
         }
 
-        static Float random01() {
-                uint64_t r = rand()%1'000'000'000;
-                if (r < 0)
-                        r = -r;
-                return Float((double)r / 1'000'000'000);
+        static constexpr Float from_unit_bits(uint64_t bits) {
+                return Float(static_cast<float>(bits >> 40) * 0x1.0p-24f);
+        }
+
+        template <typename Rng> static Float random01(Rng &rng) {
+                return from_unit_bits(rng());
         }
 };
 
@@ -54,7 +56,7 @@ float to_double(Float x) {
 }
 
 template <typename OTHER> Float operator+(Float a, OTHER b) {
-    return a + Float(to_double(b));
+    return a + numeric_cast<Float>(b);
 }
 
 template<>
@@ -67,7 +69,7 @@ Float operator-(Float x) {
 }
 
 template <typename OTHER> Float operator-(Float a, OTHER b) {
-    return a - Float(to_double(b));
+    return a - numeric_cast<Float>(b);
 }
 
 template<>
@@ -76,7 +78,7 @@ Float operator-(Float a, Float b) {
 }
 
 template <typename OTHER> Float operator*(Float a, OTHER b) {
-    return a * Float(to_double(b));
+    return a * numeric_cast<Float>(b);
 }
 
 template<>
@@ -85,7 +87,7 @@ Float operator*(Float a, Float b) {
 }
 
 template <typename OTHER> Float operator/(Float a, OTHER b) {
-    return a / Float(to_double(b));
+    return a / numeric_cast<Float>(b);
 }
 
 template<>
@@ -94,7 +96,7 @@ Float operator/(Float a, Float b) {
 }
 
 template <typename OTHER> Float &operator+=(Float &a, OTHER b) {
-    return a = a + Float(to_double(b));
+    return a = a + numeric_cast<Float>(b);
 }
 
 template<>
@@ -103,7 +105,7 @@ Float &operator+=(Float &a, Float b) {
 }
 
 template <typename OTHER> Float &operator-=(Float &a, OTHER b) {
-    return a = a - Float(to_double(b));
+    return a = a - numeric_cast<Float>(b);
 }
 
 template<>
@@ -112,7 +114,7 @@ Float &operator-=(Float &a, Float b) {
 }
 
 template <typename OTHER> Float &operator*=(Float &a, OTHER b) {
-    return a = a * Float(to_double(b));
+    return a = a * numeric_cast<Float>(b);
 }
 
 template<>
@@ -121,7 +123,7 @@ Float &operator*=(Float &a, Float b) {
 }
 
 template <typename OTHER> Float &operator/=(Float &a, OTHER b) {
-    return a = a / Float(to_double(b));
+    return a = a / numeric_cast<Float>(b);
 }
 
 template<>
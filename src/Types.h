@@ -8,6 +8,7 @@ using namespace std;
 
 #define FIXED(N, K) Fixed<N, K>
 #define FAST_FIXED(N, K) FastFixed<N, K>
+#define COMPACT_FIXED(N, K) CompactFixed<N, K>
 #define DOUBLE Double
 #define FLOAT Float
 
@@ -37,5 +38,17 @@ std::string prettify(const std::string& s) {
         return "(FastFixed<int_fast" + to_string(size) + "_t, " + s.substr(posComma + 1, posClose - posComma - 1) + ">)";
     }
 
+    f = "COMPACT_FIXED";
+    if (s.substr(0, f.size()) == f) {
+        int posOpen = s.find('(');
+        int posClose = s.find(')', posOpen);
+        int posComma = s.find(',', posOpen);
+
+        int size = stoi(s.substr(posOpen + 1, posComma - posOpen - 1));
+        size = size <= 8 ? 8 : size <= 16 ? 16 : 32;
+
+        return "(CompactFixed<int" + to_string(size) + "_t, " + s.substr(posComma + 1, posClose - posComma - 1) + ">)";
+    }
+
     throw std::runtime_error("Unknown type: " + s);
 }
\ No newline at end of file
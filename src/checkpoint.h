@@ -0,0 +1,233 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+// Flat byte image of a checkpoint. Values are copied in host byte order, so
+// a checkpoint is only meant to be read back by the same build.
+struct ByteWriter {
+    vector<uint8_t> &out;
+
+    void bytes(const void *ptr, size_t size) {
+        auto *p = static_cast<const uint8_t *>(ptr);
+        out.insert(out.end(), p, p + size);
+    }
+
+    template <typename T>
+    void put(const T &value) {
+        static_assert(is_trivially_copyable_v<T>);
+        bytes(&value, sizeof(T));
+    }
+
+    void put_string(const string &s) {
+        put(uint32_t(s.size()));
+        bytes(s.data(), s.size());
+    }
+};
+
+struct ByteReader {
+    const uint8_t *ptr;
+    const uint8_t *end;
+
+    void bytes(void *dst, size_t size) {
+        if(size_t(end - ptr) < size)
+            throw runtime_error("Truncated checkpoint");
+        memcpy(dst, ptr, size);
+        ptr += size;
+    }
+
+    template <typename T>
+    T get() {
+        static_assert(is_trivially_copyable_v<T>);
+        T value;
+        bytes(&value, sizeof(T));
+        return value;
+    }
+
+    string get_string() {
+        string s(get<uint32_t>(), '\0');
+        bytes(s.data(), s.size());
+        return s;
+    }
+};
+
+// Double-buffered checkpoint output. The simulation serialises into a free
+// buffer and goes on while a writer thread puts it on disk; it only waits
+// when both buffers are still being written. Each file is written next to
+// its target and renamed over it, so a crash mid-write leaves the previous
+// checkpoint intact.
+class CheckpointWriter {
+public:
+    CheckpointWriter() {
+        for(auto &b : buffers)
+            free_list.push_back(&b);
+        writer = thread([this] { writer_loop(); });
+    }
+
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter &) = delete;
+
+    ~CheckpointWriter() {
+        {
+            lock_guard lock(mtx);
+            stopping = true;
+        }
+        ready_cv.notify_one();
+        writer.join();
+    }
+
+    vector<uint8_t>& acquire() {
+        unique_lock lock(mtx);
+        free_cv.wait(lock, [this] { return !free_list.empty(); });
+        vector<uint8_t> *buf = free_list.back();
+        free_list.pop_back();
+        buf->clear();
+        return *buf;
+    }
+
+    void submit(vector<uint8_t> &buf, const string &path) {
+        {
+            lock_guard lock(mtx);
+            ready.push_back({&buf, path});
+        }
+        ready_cv.notify_one();
+    }
+
+    // Returns once every submitted checkpoint is on disk.
+    void wait() {
+        unique_lock lock(mtx);
+        free_cv.wait(lock, [this] { return free_list.size() == 2; });
+    }
+
+    // Number of checkpoints that could not be written; read it after wait().
+    size_t failures() const {
+        return failed;
+    }
+
+private:
+    struct Job {
+        vector<uint8_t> *buf;
+        string path;
+    };
+
+    void writer_loop() {
+        while(true) {
+            Job job;
+            {
+                unique_lock lock(mtx);
+                ready_cv.wait(lock, [this] { return stopping || !ready.empty(); });
+                if(ready.empty())
+                    return;
+                job = ready.front();
+                ready.pop_front();
+            }
+            bool ok = write_file(*job.buf, job.path);
+            {
+                lock_guard lock(mtx);
+                failed += !ok;
+                free_list.push_back(job.buf);
+            }
+            free_cv.notify_all();
+        }
+    }
+
+    static bool write_file(const vector<uint8_t> &buf, const string &path) {
+        string tmp = path + ".tmp";
+        FILE *file = fopen(tmp.c_str(), "wb");
+        if(!file)
+            return false;
+        bool ok = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+        ok = fclose(file) == 0 && ok;
+        return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    vector<uint8_t> buffers[2];
+    vector<vector<uint8_t> *> free_list;
+    deque<Job> ready;
+    mutex mtx;
+    condition_variable ready_cv;
+    condition_variable free_cv;
+    thread writer;
+    size_t failed = 0;
+    bool stopping = false;
+};
+
+// A checkpoint file is this header, the simulator's arena image at
+// arena_offset, and the remaining scalar state (materials, gravity,
+// counters, random streams) at state_offset, written with ByteWriter. The
+// arena image is the fields exactly as they sit in memory, so resuming maps
+// it instead of parsing it. The type strings are spelled as in TYPES and
+// --p-type.
+struct CheckpointHeader {
+    static constexpr char file_magic[4] = {'F', 'L', 'C', 'K'};
+    static constexpr uint32_t file_version = 3;
+
+    char magic[4];
+    uint32_t version;
+    char p_type[32];
+    char v_type[32];
+    char vf_type[32];
+    uint32_t n;
+    uint32_t m;
+    uint64_t tick;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+    uint64_t state_offset;
+    uint64_t state_size;
+};
+
+inline void set_type_name(char (&out)[32], const string &name) {
+    if(name.size() >= sizeof(out))
+        throw runtime_error("Type name too long for a checkpoint: " + name);
+    memset(out, 0, sizeof(out));
+    memcpy(out, name.data(), name.size());
+}
+
+inline string type_name(const char (&in)[32]) {
+    return string(in, strnlen(in, sizeof(in)));
+}
+
+// Reads and checks the header only, so a checkpoint can be matched against a
+// build before anything is allocated.
+inline CheckpointHeader read_checkpoint_header(const string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file)
+        throw runtime_error("Cannot open checkpoint: " + path);
+    CheckpointHeader h;
+    bool ok = fread(&h, sizeof(h), 1, file) == 1;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fclose(file);
+    if(!ok || memcmp(h.magic, CheckpointHeader::file_magic, sizeof(h.magic)) != 0)
+        throw runtime_error("Not a checkpoint: " + path);
+    if(h.version != CheckpointHeader::file_version)
+        throw runtime_error("Checkpoint version " + to_string(h.version) + " is not supported");
+    if(length < 0 || uint64_t(length) < h.state_offset + h.state_size ||
+       h.arena_offset + h.arena_size > h.state_offset)
+        throw runtime_error("Truncated checkpoint: " + path);
+    return h;
+}
+
+inline vector<uint8_t> read_checkpoint_range(const string &path, uint64_t offset, uint64_t size) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file)
+        throw runtime_error("Cannot open checkpoint: " + path);
+    vector<uint8_t> data(size);
+    bool ok = fseek(file, long(offset), SEEK_SET) == 0 &&
+              fread(data.data(), 1, size, file) == size;
+    fclose(file);
+    if(!ok)
+        throw runtime_error("Truncated checkpoint: " + path);
+    return data;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+template <size_t S, size_t K>
+class Fixed;
+
+template <size_t N, size_t K>
+class FastFixed;
+
+template <size_t N, size_t K>
+class CompactFixed;
+
+class Float;
+class Double;
+
+template <typename T>
+struct is_fixed_point : false_type {};
+
+template <size_t N, size_t K>
+struct is_fixed_point<Fixed<N, K>> : true_type {};
+
+template <size_t N, size_t K>
+struct is_fixed_point<FastFixed<N, K>> : true_type {};
+
+template <size_t N, size_t K>
+struct is_fixed_point<CompactFixed<N, K>> : true_type {};
+
+template <typename T>
+inline constexpr bool is_fixed_point_v = is_fixed_point<T>::value;
+
+template <typename T>
+inline constexpr bool is_floating_class_v = is_same_v<T, Float> || is_same_v<T, Double>;
+
+// How a numeric type is spelled in TYPES and on the command line, e.g.
+// "FAST_FIXED(32,16)"; check_type_match accepts exactly these strings.
+template <typename T>
+struct numeric_name;
+
+template <size_t N, size_t K>
+struct numeric_name<Fixed<N, K>> {
+    static string get() { return "FIXED(" + to_string(N) + "," + to_string(K) + ")"; }
+};
+
+template <size_t N, size_t K>
+struct numeric_name<FastFixed<N, K>> {
+    static string get() { return "FAST_FIXED(" + to_string(N) + "," + to_string(K) + ")"; }
+};
+
+template <size_t N, size_t K>
+struct numeric_name<CompactFixed<N, K>> {
+    static string get() { return "COMPACT_FIXED(" + to_string(N) + "," + to_string(K) + ")"; }
+};
+
+template <>
+struct numeric_name<Float> {
+    static string get() { return "FLOAT"; }
+};
+
+template <>
+struct numeric_name<Double> {
+    static string get() { return "DOUBLE"; }
+};
+
+// numeric_cast<To>(x) converts between Fixed, FastFixed, CompactFixed, Float,
+// Double and the built-in arithmetic types without detours:
+//  - fixed to fixed shifts the raw value by the difference in fractional
+//    bits (rounding toward negative infinity) and saturates to the target's
+//    Bits-wide range;
+//  - fixed to floating point is one multiply by the reciprocal scale, done
+//    in float for float targets and in double otherwise;
+//  - floating point to fixed scales once, saturates, and maps NaN to 0;
+//  - floating point to floating point is a plain cast.
+template <typename To, typename From>
+constexpr To numeric_cast(const From &x);
+
+namespace numeric_cast_detail {
+
+// The value of a floating-point or integral source as float or double.
+template <typename T>
+constexpr auto float_value(const T &x) {
+    if constexpr(is_floating_class_v<T>)
+        return x.v;
+    else if constexpr(is_floating_point_v<T>)
+        return x;
+    else
+        return static_cast<double>(x);
+}
+
+template <typename To>
+constexpr auto raw_limits() {
+    using Wide = __int128;
+    constexpr Wide hi = (Wide(1) << (To::Bits - 1)) - 1;
+    return pair<Wide, Wide>{-hi - 1, hi};
+}
+
+template <typename To, typename From>
+constexpr To fixed_to_fixed(const From &x) {
+    using Wide = __int128;
+    Wide r = x.v;
+    if constexpr(To::Fraction >= From::Fraction)
+        r *= Wide(1) << (To::Fraction - From::Fraction);
+    else
+        r >>= From::Fraction - To::Fraction;
+    constexpr auto limits = raw_limits<To>();
+    r = r < limits.first ? limits.first : r > limits.second ? limits.second : r;
+    return To::from_raw(static_cast<typename To::RawType>(r));
+}
+
+template <typename To, typename F>
+constexpr To float_to_fixed(F f) {
+    constexpr auto limits = raw_limits<To>();
+    constexpr F lo = static_cast<F>(limits.first);
+    constexpr F hi = static_cast<F>(limits.second);
+    F scaled = f * static_cast<F>(To::scale);
+    if(!(scaled == scaled))
+        return To::from_raw(0);
+    if(scaled <= lo)
+        return To::from_raw(static_cast<typename To::RawType>(limits.first));
+    if(scaled >= hi)
+        return To::from_raw(static_cast<typename To::RawType>(limits.second));
+    return To::from_raw(static_cast<typename To::RawType>(scaled));
+}
+
+template <typename To, typename From>
+constexpr To fixed_to_float(const From &x) {
+    if constexpr(is_same_v<To, float> || is_same_v<To, Float>)
+        return To(static_cast<float>(x.v) * static_cast<float>(1.0 / From::scale));
+    else
+        return To(static_cast<double>(x.v) * (1.0 / From::scale));
+}
+
+}
+
+template <typename To, typename From>
+constexpr To numeric_cast(const From &x) {
+    using namespace numeric_cast_detail;
+    if constexpr(is_same_v<To, From>)
+        return x;
+    else if constexpr(is_fixed_point_v<From> && is_fixed_point_v<To>)
+        return fixed_to_fixed<To>(x);
+    else if constexpr(is_fixed_point_v<From>)
+        return fixed_to_float<To>(x);
+    else if constexpr(is_fixed_point_v<To>)
+        return float_to_fixed<To>(float_value(x));
+    else if constexpr(is_floating_class_v<To>)
+        return To(static_cast<decltype(To::v)>(float_value(x)));
+    else
+        return static_cast<To>(float_value(x));
+}
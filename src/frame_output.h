@@ -0,0 +1,138 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __unix__
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Formats whole frames into reusable buffers and hands each one to the OS in
+// a single write. In async mode a writer thread drains the frames while the
+// simulation goes on; at most depth frames are in flight, after which
+// frame() waits for a free buffer, so no frame is ever dropped.
+class FrameWriter {
+public:
+    explicit FrameWriter(bool async = false, size_t depth = 4) {
+        buffers.resize(async ? depth : 1);
+        for(auto &b : buffers)
+            free_list.push_back(&b);
+        if(async)
+            writer = thread([this] { writer_loop(); });
+    }
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter& operator=(const FrameWriter &) = delete;
+
+    ~FrameWriter() {
+        if(writer.joinable()) {
+            {
+                lock_guard lock(mtx);
+                stopping = true;
+            }
+            ready_cv.notify_one();
+            writer.join();
+        }
+    }
+
+    // Writes a rows x cols frame, one line per row, with cell(x, y) giving
+    // each character.
+    template <typename F>
+    void frame(size_t rows, size_t cols, F &&cell) {
+        vector<char> *buf = acquire();
+        buf->resize(rows * (cols + 1));
+        char *out = buf->data();
+        for(size_t x = 0; x < rows; ++x) {
+            for(size_t y = 0; y < cols; ++y)
+                *out++ = cell(x, y);
+            *out++ = '\n';
+        }
+        submit(buf);
+    }
+
+    // Returns once every submitted frame has been written.
+    void flush() {
+        unique_lock lock(mtx);
+        free_cv.wait(lock, [this] { return free_list.size() == buffers.size(); });
+    }
+
+private:
+    vector<char>* acquire() {
+        unique_lock lock(mtx);
+        free_cv.wait(lock, [this] { return !free_list.empty(); });
+        vector<char> *buf = free_list.back();
+        free_list.pop_back();
+        return buf;
+    }
+
+    void submit(vector<char> *buf) {
+        if(!writer.joinable()) {
+            write_all(*buf);
+            lock_guard lock(mtx);
+            free_list.push_back(buf);
+            return;
+        }
+        {
+            lock_guard lock(mtx);
+            ready.push_back(buf);
+        }
+        ready_cv.notify_one();
+    }
+
+    void writer_loop() {
+        while(true) {
+            vector<char> *buf;
+            {
+                unique_lock lock(mtx);
+                ready_cv.wait(lock, [this] { return stopping || !ready.empty(); });
+                if(ready.empty())
+                    return;
+                buf = ready.front();
+                ready.pop_front();
+            }
+            write_all(*buf);
+            {
+                lock_guard lock(mtx);
+                free_list.push_back(buf);
+            }
+            free_cv.notify_all();
+        }
+    }
+
+    static void write_all(const vector<char> &buf) {
+#ifdef __unix__
+        const char *ptr = buf.data();
+        size_t left = buf.size();
+        while(left > 0) {
+            ssize_t n = ::write(STDOUT_FILENO, ptr, left);
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+                return;
+            }
+            ptr += n;
+            left -= size_t(n);
+        }
+#else
+        fwrite(buf.data(), 1, buf.size(), stdout);
+        fflush(stdout);
+#endif
+    }
+
+    vector<vector<char>> buffers;
+    vector<vector<char> *> free_list;
+    deque<vector<char> *> ready;
+    mutex mtx;
+    condition_variable ready_cv;
+    condition_variable free_cv;
+    thread writer;
+    bool stopping = false;
+};
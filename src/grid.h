@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// One aligned allocation that grids carve their storage from. An arena
+// without memory only counts: binding every grid against it first gives the
+// exact size to reserve, so the layout is written down once.
+class Arena {
+public:
+    static constexpr size_t alignment = 64;
+    static constexpr size_t huge_page = size_t(2) << 20;
+
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+    Arena& operator=(const Arena &) = delete;
+
+    ~Arena() {
+        release();
+    }
+
+    // With huge_pages the block is 2 MiB aligned and the kernel is asked to
+    // back it with transparent huge pages; elsewhere the flag is a no-op.
+    void reserve(size_t bytes, bool huge_pages = false) {
+        release();
+        capacity = bytes;
+        used = 0;
+        if(bytes == 0)
+            return;
+        size_t align = huge_pages ? huge_page : alignment;
+        size_t total = (bytes + align - 1) / align * align;
+        base = static_cast<char *>(aligned_alloc(align, total));
+        if(!base)
+            throw bad_alloc();
+#ifdef MADV_HUGEPAGE
+        if(huge_pages)
+            madvise(base, total, MADV_HUGEPAGE);
+#endif
+    }
+
+    template <typename T>
+    T* take(size_t count) {
+        static_assert(is_trivially_destructible_v<T>);
+        size_t offset = used;
+        used += round_up(count * sizeof(T));
+        if(!base)
+            return nullptr;
+        assert(used <= capacity);
+        T *ptr = reinterpret_cast<T *>(base + offset);
+        if(!mapped)
+            uninitialized_value_construct_n(ptr, count);
+        return ptr;
+    }
+
+    // Takes bytes [offset, offset + bytes) of a file, written from an arena
+    // with the same layout, as the contents: grids bound afterwards see the
+    // saved values. On POSIX the file is mapped privately, so pages are read
+    // on first touch and copied on first write, and the file never changes;
+    // elsewhere it is read into a fresh block.
+    void map(const string &path, size_t offset, size_t bytes) {
+        assert(offset % alignment == 0);
+        release();
+        capacity = bytes;
+        used = 0;
+        if(bytes == 0)
+            return;
+#ifdef __unix__
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw runtime_error("Cannot open " + path);
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < offset + bytes) {
+            close(fd);
+            throw runtime_error("Truncated " + path);
+        }
+        void *ptr = mmap(nullptr, offset + bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(ptr == MAP_FAILED)
+            throw runtime_error("Cannot map " + path);
+        mapping = ptr;
+        mapping_size = offset + bytes;
+        base = static_cast<char *>(ptr) + offset;
+#else
+        reserve(bytes);
+        FILE *file = fopen(path.c_str(), "rb");
+        bool ok = file && fseek(file, long(offset), SEEK_SET) == 0 &&
+                  fread(base, 1, bytes, file) == bytes;
+        if(file)
+            fclose(file);
+        if(!ok)
+            throw runtime_error("Cannot read " + path);
+        capacity = bytes;
+#endif
+        mapped = true;
+    }
+
+    const char* data() const {
+        return base;
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+private:
+    void release() {
+#ifdef __unix__
+        if(mapping) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+            base = nullptr;
+        }
+#endif
+        free(base);
+        base = nullptr;
+        mapped = false;
+    }
+
+    static size_t round_up(size_t bytes) {
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    char *base = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    // Set once the contents come from a checkpoint; take() keeps them.
+    bool mapped = false;
+#ifdef __unix__
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+#endif
+};
+
+// Row-major S1 x S2 grid living in an Arena. grid[x][y] works the same for
+// both flavours; with compile-time extents the row stride is a constant.
+template <typename T, size_t S1, size_t S2>
+struct Grid {
+    T (*v)[S2] = nullptr;
+
+    void bind(Arena &arena, size_t, size_t) {
+        v = reinterpret_cast<T (*)[S2]>(arena.template take<T>(S1 * S2));
+    }
+
+    T* operator[](size_t x) {
+        return v[x];
+    }
+
+    const T* operator[](size_t x) const {
+        return v[x];
+    }
+
+    T* data() {
+        return &v[0][0];
+    }
+
+    const T* data() const {
+        return &v[0][0];
+    }
+
+    size_t rows() const {
+        return S1;
+    }
+
+    size_t cols() const {
+        return S2;
+    }
+
+    size_t size() const {
+        return S1 * S2;
+    }
+
+    void fill(const T &value) {
+        std::fill(data(), data() + size(), value);
+    }
+
+    void swap(Grid &other) {
+        std::swap(v, other.v);
+    }
+};
+
+// Runtime-sized grid: a view into an Arena with a runtime row stride.
+template <typename T>
+struct Grid<T, 0, 0> {
+    T *ptr = nullptr;
+    size_t n = 0, m = 0;
+
+    void bind(Arena &arena, size_t rows, size_t cols) {
+        ptr = arena.template take<T>(rows * cols);
+        n = rows;
+        m = cols;
+    }
+
+    T* operator[](size_t x) {
+        return ptr + x * m;
+    }
+
+    const T* operator[](size_t x) const {
+        return ptr + x * m;
+    }
+
+    T* data() {
+        return ptr;
+    }
+
+    const T* data() const {
+        return ptr;
+    }
+
+    size_t rows() const {
+        return n;
+    }
+
+    size_t cols() const {
+        return m;
+    }
+
+    size_t size() const {
+        return n * m;
+    }
+
+    void fill(const T &value) {
+        std::fill(data(), data() + size(), value);
+    }
+
+    void swap(Grid &other) {
+        std::swap(ptr, other.ptr);
+        std::swap(n, other.n);
+        std::swap(m, other.m);
+    }
+};
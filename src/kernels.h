@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLUID_SIMD_X86 1
+#define FLUID_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+// Row kernels for the pressure gradient and for the first half of the
+// threaded velocity apply, working on the raw double / float storage behind
+// Double and Float. One call covers the fluid cells [y0, y1) of one row for
+// one direction; every pointer is already offset so that index y addresses
+// cell y (or its neighbour across the edge).
+//
+// A lane only writes state of the edge it owns, through masked stores, and
+// performs the same IEEE operations as the scalar sweep, so both paths give
+// bit-identical fields. The returned pressure totals are summed in a
+// different order.
+
+template <typename R>
+struct GradientRow {
+    const R *old_p;
+    const R *old_p_nb;
+    const uint8_t *open;
+    const uint8_t *field;
+    const uint8_t *field_nb;
+    const int *dirs;
+    R *v_out;
+    R *contr;
+    R *p;
+    const R *rho;
+    const R *inv_rho;
+    const R *inv_dirs;
+    unsigned bit;
+};
+
+template <typename R>
+struct PushRow {
+    R *v;
+    const R *vf;
+    const uint32_t *stamp;
+    uint32_t epoch;
+    const uint8_t *open;
+    const uint8_t *field;
+    const int *dirs;
+    const int *dirs_nb;
+    R *push;
+    const R *rho;
+    const R *damp;
+    const R *inv_dirs;
+    unsigned bit;
+};
+
+inline bool simd_supported() {
+#ifdef FLUID_SIMD_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+template <typename R>
+R gradient_cell(const GradientRow<R> &g, size_t y) {
+    if(!((g.open[y] >> g.bit) & 1) || !(g.old_p_nb[y] < g.old_p[y]))
+        return 0;
+    uint8_t nb = g.field_nb[y];
+    R force = g.old_p[y] - g.old_p_nb[y];
+    R cr = g.contr[y] * g.rho[nb];
+    if(force <= cr) {
+        g.contr[y] -= force * g.inv_rho[nb];
+        return 0;
+    }
+    force -= cr;
+    g.contr[y] = 0;
+    g.v_out[y] += force * g.inv_rho[g.field[y]];
+    R share = force * g.inv_dirs[g.dirs[y]];
+    g.p[y] -= share;
+    return share;
+}
+
+template <typename R>
+void push_cell(const PushRow<R> &q, size_t y) {
+    R old_v = q.v[y];
+    R new_v = q.stamp[y] == q.epoch ? q.vf[y] : R(0);
+    if(!(old_v > 0)) {
+        q.push[y] = 0;
+        return;
+    }
+    q.v[y] = new_v;
+    uint8_t c = q.field[y];
+    R force = (old_v - new_v) * q.rho[c] * q.damp[c];
+    q.push[y] = force * q.inv_dirs[(q.open[y] >> q.bit) & 1 ? q.dirs_nb[y] : q.dirs[y]];
+}
+
+#ifdef FLUID_SIMD_X86
+
+// Lane helpers. idx holds one 32-bit integer per lane.
+template <typename R>
+struct Avx2;
+
+template <>
+struct Avx2<double> {
+    using reg = __m256d;
+    using idx = __m128i;
+    static constexpr size_t lanes = 4;
+
+    FLUID_AVX2 static reg load(const double *ptr) { return _mm256_loadu_pd(ptr); }
+    FLUID_AVX2 static void store(double *ptr, reg v) { _mm256_storeu_pd(ptr, v); }
+    FLUID_AVX2 static reg maskload(const double *ptr, reg m) { return _mm256_maskload_pd(ptr, _mm256_castpd_si256(m)); }
+    FLUID_AVX2 static void maskstore(double *ptr, reg m, reg v) { _mm256_maskstore_pd(ptr, _mm256_castpd_si256(m), v); }
+    FLUID_AVX2 static reg set1(double v) { return _mm256_set1_pd(v); }
+    FLUID_AVX2 static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    FLUID_AVX2 static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    FLUID_AVX2 static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    FLUID_AVX2 static reg lt(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    FLUID_AVX2 static reg le(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    FLUID_AVX2 static reg gt(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    FLUID_AVX2 static reg and_(reg a, reg b) { return _mm256_and_pd(a, b); }
+    FLUID_AVX2 static reg andnot(reg a, reg b) { return _mm256_andnot_pd(a, b); }
+    FLUID_AVX2 static reg blend(reg a, reg b, reg m) { return _mm256_blendv_pd(a, b, m); }
+    FLUID_AVX2 static bool none(reg m) { return _mm256_movemask_pd(m) == 0; }
+
+    FLUID_AVX2 static idx bytes(const void *ptr) {
+        int32_t raw;
+        memcpy(&raw, ptr, sizeof(raw));
+        return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(raw));
+    }
+    FLUID_AVX2 static idx ints(const void *ptr) { return _mm_loadu_si128(static_cast<const __m128i *>(ptr)); }
+    FLUID_AVX2 static idx set1_idx(int v) { return _mm_set1_epi32(v); }
+    FLUID_AVX2 static idx and_idx(idx a, idx b) { return _mm_and_si128(a, b); }
+    FLUID_AVX2 static idx eq_idx(idx a, idx b) { return _mm_cmpeq_epi32(a, b); }
+    FLUID_AVX2 static idx blend_idx(idx a, idx b, idx m) { return _mm_blendv_epi8(a, b, m); }
+    FLUID_AVX2 static reg widen(idx m) { return _mm256_castsi256_pd(_mm256_cvtepi32_epi64(m)); }
+    FLUID_AVX2 static reg gather(const double *table, idx i) { return _mm256_i32gather_pd(table, i, 8); }
+};
+
+template <>
+struct Avx2<float> {
+    using reg = __m256;
+    using idx = __m256i;
+    static constexpr size_t lanes = 8;
+
+    FLUID_AVX2 static reg load(const float *ptr) { return _mm256_loadu_ps(ptr); }
+    FLUID_AVX2 static void store(float *ptr, reg v) { _mm256_storeu_ps(ptr, v); }
+    FLUID_AVX2 static reg maskload(const float *ptr, reg m) { return _mm256_maskload_ps(ptr, _mm256_castps_si256(m)); }
+    FLUID_AVX2 static void maskstore(float *ptr, reg m, reg v) { _mm256_maskstore_ps(ptr, _mm256_castps_si256(m), v); }
+    FLUID_AVX2 static reg set1(float v) { return _mm256_set1_ps(v); }
+    FLUID_AVX2 static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    FLUID_AVX2 static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    FLUID_AVX2 static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    FLUID_AVX2 static reg lt(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    FLUID_AVX2 static reg le(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    FLUID_AVX2 static reg gt(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    FLUID_AVX2 static reg and_(reg a, reg b) { return _mm256_and_ps(a, b); }
+    FLUID_AVX2 static reg andnot(reg a, reg b) { return _mm256_andnot_ps(a, b); }
+    FLUID_AVX2 static reg blend(reg a, reg b, reg m) { return _mm256_blendv_ps(a, b, m); }
+    FLUID_AVX2 static bool none(reg m) { return _mm256_movemask_ps(m) == 0; }
+
+    FLUID_AVX2 static idx bytes(const void *ptr) {
+        int64_t raw;
+        memcpy(&raw, ptr, sizeof(raw));
+        return _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(raw));
+    }
+    FLUID_AVX2 static idx ints(const void *ptr) { return _mm256_loadu_si256(static_cast<const __m256i *>(ptr)); }
+    FLUID_AVX2 static idx set1_idx(int v) { return _mm256_set1_epi32(v); }
+    FLUID_AVX2 static idx and_idx(idx a, idx b) { return _mm256_and_si256(a, b); }
+    FLUID_AVX2 static idx eq_idx(idx a, idx b) { return _mm256_cmpeq_epi32(a, b); }
+    FLUID_AVX2 static idx blend_idx(idx a, idx b, idx m) { return _mm256_blendv_epi8(a, b, m); }
+    FLUID_AVX2 static reg widen(idx m) { return _mm256_castsi256_ps(m); }
+    FLUID_AVX2 static reg gather(const float *table, idx i) { return _mm256_i32gather_ps(table, i, 4); }
+};
+
+// Loads from cells across an edge the lane does not own are masked, since a
+// thread working on the neighbouring band may be writing them.
+template <typename R>
+FLUID_AVX2 R gradient_run_avx2(const GradientRow<R> &g, size_t y0, size_t y1) {
+    using S = Avx2<R>;
+    const auto bit = S::set1_idx(1 << g.bit);
+    const auto zero = S::set1(0);
+    R total = 0;
+    size_t y = y0;
+    for(; y + S::lanes <= y1; y += S::lanes) {
+        auto oc = S::load(g.old_p + y);
+        auto onb = S::load(g.old_p_nb + y);
+        auto open = S::widen(S::eq_idx(S::and_idx(S::bytes(g.open + y), bit), bit));
+        auto edge = S::and_(open, S::lt(onb, oc));
+        if(S::none(edge))
+            continue;
+        auto fnb = S::bytes(g.field_nb + y);
+        auto force = S::sub(oc, onb);
+        auto contr = S::maskload(g.contr + y, edge);
+        auto cr = S::mul(contr, S::gather(g.rho, fnb));
+        auto small = S::and_(edge, S::le(force, cr));
+        auto big = S::andnot(small, edge);
+        auto eased = S::sub(contr, S::mul(force, S::gather(g.inv_rho, fnb)));
+        S::maskstore(g.contr + y, edge, S::blend(zero, eased, small));
+        if(S::none(big))
+            continue;
+        force = S::sub(force, cr);
+        auto v = S::maskload(g.v_out + y, big);
+        auto irc = S::gather(g.inv_rho, S::bytes(g.field + y));
+        S::maskstore(g.v_out + y, big, S::add(v, S::mul(force, irc)));
+        auto share = S::mul(force, S::gather(g.inv_dirs, S::ints(g.dirs + y)));
+        S::maskstore(g.p + y, big, S::sub(S::load(g.p + y), share));
+        R lanes[S::lanes];
+        auto taken = S::and_(share, big);
+        memcpy(lanes, &taken, sizeof(lanes));
+        for(R t : lanes)
+            total += t;
+    }
+    for(; y < y1; ++y)
+        total += gradient_cell(g, y);
+    return total;
+}
+
+template <typename R>
+FLUID_AVX2 void push_run_avx2(const PushRow<R> &q, size_t y0, size_t y1) {
+    using S = Avx2<R>;
+    const auto bit = S::set1_idx(1 << q.bit);
+    const auto zero = S::set1(0);
+    const auto epoch = S::set1_idx(int(q.epoch));
+    size_t y = y0;
+    for(; y + S::lanes <= y1; y += S::lanes) {
+        auto old_v = S::load(q.v + y);
+        auto fresh = S::widen(S::eq_idx(S::ints(q.stamp + y), epoch));
+        auto new_v = S::and_(S::load(q.vf + y), fresh);
+        auto pos = S::gt(old_v, zero);
+        S::maskstore(q.v + y, pos, new_v);
+        auto fc = S::bytes(q.field + y);
+        auto force = S::mul(S::sub(old_v, new_v), S::gather(q.rho, fc));
+        force = S::mul(force, S::gather(q.damp, fc));
+        auto openi = S::eq_idx(S::and_idx(S::bytes(q.open + y), bit), bit);
+        auto count = S::blend_idx(S::ints(q.dirs + y), S::ints(q.dirs_nb + y), openi);
+        auto push = S::mul(force, S::gather(q.inv_dirs, count));
+        S::store(q.push + y, S::and_(push, pos));
+    }
+    for(; y < y1; ++y)
+        push_cell(q, y);
+}
+
+#endif
+
+// Entry points for the simulator; only called once simd_supported() said yes.
+template <typename R>
+R gradient_run(const GradientRow<R> &g, size_t y0, size_t y1) {
+#ifdef FLUID_SIMD_X86
+    return gradient_run_avx2(g, y0, y1);
+#else
+    R total = 0;
+    for(size_t y = y0; y < y1; ++y)
+        total += gradient_cell(g, y);
+    return total;
+#endif
+}
+
+template <typename R>
+void push_run(const PushRow<R> &q, size_t y0, size_t y1) {
+#ifdef FLUID_SIMD_X86
+    push_run_avx2(q, y0, y1);
+#else
+    for(size_t y = y0; y < y1; ++y)
+        push_cell(q, y);
+#endif
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Scenario;
+
+// Reference is the original repeated unit-limited DFS sweep; Dinic retires
+// cells and edges with current arcs in a single sweep.
+enum class FlowSolver {
+    Reference,
+    Dinic
+};
+
+// Simd runs the gradient and velocity-apply rows through the AVX2 kernels in
+// kernels.h where the CPU and the numeric types allow it, and falls back to
+// the scalar sweeps otherwise.
+enum class Kernel {
+    Scalar,
+    Simd
+};
+
+struct SimulationOptions {
+    size_t threads = 1;
+    bool parallel_move = false;
+    uint64_t seed = 1;
+    bool huge_pages = false;
+    bool sparse = false;
+    bool verify_sparse = false;
+    FlowSolver flow_solver = FlowSolver::Reference;
+    bool flow_worklist = false;
+    Kernel kernel = Kernel::Scalar;
+    // Every render_every-th frame is printed; 0 turns rendering off.
+    size_t render_every = 1;
+    bool render_async = false;
+    // Binary trajectory (see trajectory.h); empty disables it.
+    std::string trajectory;
+    bool trajectory_p = false;
+    bool trajectory_velocity = false;
+    size_t keyframe_every = 256;
+    size_t ticks = 500;
+    // Checkpoint every save_interval ticks to checkpoint (0 disables it);
+    // resume names a checkpoint whose fields are mapped to continue from.
+    size_t save_interval = 0;
+    std::string checkpoint;
+    std::string resume;
+    // Initial map, materials and gravity (see scenario.h); must outlive the
+    // simulator's construction.
+    const Scenario *scenario = nullptr;
+};
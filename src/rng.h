@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// xoshiro256** by Blackman and Vigna. Small, fast and fully determined by its
+// 256-bit state, so a run is reproducible from the seed alone. jump() moves
+// the generator 2^128 draws ahead, which is how independent per-thread and
+// per-region streams are carved out of one seed.
+class Rng {
+public:
+    using result_type = uint64_t;
+
+    explicit Rng(uint64_t seed = 1) {
+        this->seed(seed);
+    }
+
+    void seed(uint64_t seed) {
+        for(auto &word : s)
+            word = splitmix64(seed);
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return UINT64_MAX;
+    }
+
+    result_type operator()() {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    void jump() {
+        static constexpr uint64_t JUMP[] = {
+            0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c
+        };
+        uint64_t t[4] = {0, 0, 0, 0};
+        for(uint64_t word : JUMP) {
+            for(int b = 0; b < 64; ++b) {
+                if(word & (uint64_t(1) << b)) {
+                    for(int i = 0; i < 4; ++i)
+                        t[i] ^= s[i];
+                }
+                (*this)();
+            }
+        }
+        for(int i = 0; i < 4; ++i)
+            s[i] = t[i];
+    }
+
+    // Returns a copy of this stream and advances this one past it, so
+    // successive calls hand out non-overlapping streams.
+    Rng split() {
+        Rng child = *this;
+        jump();
+        return child;
+    }
+
+    // Uniform value in [0, 1) built straight from the random bits, with no
+    // detour through double for fixed-point types.
+    template <typename T>
+    T uniform01() {
+        return T::from_unit_bits((*this)());
+    }
+
+    template <typename T>
+    void fill_uniform01(T *out, size_t n) {
+        for(size_t i = 0; i < n; ++i)
+            out[i] = uniform01<T>();
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static uint64_t splitmix64(uint64_t &x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t s[4];
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Read-only view of a whole file. On POSIX the file is mapped, so nothing is
+// copied and pages come in as they are scanned; elsewhere it is read once.
+class MappedFile {
+public:
+    explicit MappedFile(const string &path) {
+#ifdef __unix__
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw runtime_error("Cannot open " + path);
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("Cannot read " + path);
+        }
+        length = size_t(st.st_size);
+        if(length > 0) {
+            void *ptr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(ptr == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Cannot map " + path);
+            }
+#ifdef MADV_SEQUENTIAL
+            madvise(ptr, length, MADV_SEQUENTIAL);
+#endif
+            mapping = static_cast<const char *>(ptr);
+        }
+        close(fd);
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if(!file)
+            throw runtime_error("Cannot open " + path);
+        char chunk[1 << 16];
+        size_t n;
+        while((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            contents.insert(contents.end(), chunk, chunk + n);
+        fclose(file);
+        length = contents.size();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifdef __unix__
+        if(mapping)
+            munmap(const_cast<char *>(mapping), length);
+#endif
+    }
+
+    const char* begin() const {
+#ifdef __unix__
+        return mapping;
+#else
+        return contents.data();
+#endif
+    }
+
+    const char* end() const {
+        return begin() + length;
+    }
+
+private:
+    size_t length = 0;
+#ifdef __unix__
+    const char *mapping = nullptr;
+#else
+    vector<char> contents;
+#endif
+};
+
+// Initial state of a run. A scenario file is a few directive lines followed
+// by the map:
+//
+//   # comment
+//   gravity 0.1
+//   material ' ' 0.01
+//   material '.' 1000 damping 0.8 p 0
+//   material '#' wall
+//   map
+//   ####...
+//
+// material sets the density, and optionally the damping, wall flag and
+// starting pressure, of one map symbol; anything left out keeps the
+// simulator's default. Every line after `map` is one row of the map, all of
+// the same width, which fixes the grid size. Symbols without a material line
+// get a zero density.
+//
+// Opening a scenario parses the directives and checks the row widths; the
+// rows stay in the mapped file and are translated straight into the field by
+// Simulator::load_scenario.
+class Scenario {
+public:
+    struct Material {
+        char symbol;
+        optional<double> rho;
+        optional<double> damping;
+        optional<double> p;
+        bool wall = false;
+    };
+
+    vector<Material> materials;
+    optional<double> gravity;
+    size_t rows = 0;
+    size_t cols = 0;
+
+    explicit Scenario(const string &path) : name(path), file(path) {
+        const char *pos = file.begin();
+        while(pos < file.end()) {
+            const char *eol = line_end(pos);
+            ++line;
+            string_view text = trim(string_view(pos, size_t(eol - pos)));
+            pos = next_line(eol);
+            if(text.empty() || text[0] == '#')
+                continue;
+            if(text == "map") {
+                map_begin = pos;
+                break;
+            }
+            directive(text);
+        }
+        if(!map_begin)
+            fail("missing map section");
+        scan_map();
+    }
+
+    Scenario(const Scenario &) = delete;
+    Scenario& operator=(const Scenario &) = delete;
+
+    // Calls f(x, row) with a pointer to the cols symbols of every map row.
+    template <typename F>
+    void for_each_row(F &&f) const {
+        const char *pos = map_begin;
+        for(size_t x = 0; x < rows; ++x) {
+            f(x, pos);
+            pos = next_line(line_end(pos));
+        }
+    }
+
+private:
+    const char* line_end(const char *pos) const {
+        auto *eol = static_cast<const char *>(memchr(pos, '\n', size_t(file.end() - pos)));
+        return eol ? eol : file.end();
+    }
+
+    const char* next_line(const char *eol) const {
+        return eol < file.end() ? eol + 1 : eol;
+    }
+
+    static string_view trim(string_view s) {
+        while(!s.empty() && (s.back() == '\r' || s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        return s;
+    }
+
+    [[noreturn]] void fail(const string &what) const {
+        throw runtime_error(name + ":" + to_string(line) + ": " + what);
+    }
+
+    // Splits off the next blank-separated word of s.
+    static string_view word(string_view &s) {
+        s = trim(s);
+        size_t n = 0;
+        while(n < s.size() && s[n] != ' ' && s[n] != '\t')
+            ++n;
+        string_view w = s.substr(0, n);
+        s.remove_prefix(n);
+        return w;
+    }
+
+    double number(string_view &s) const {
+        string_view w = word(s);
+        double value;
+        auto [end, ec] = from_chars(w.data(), w.data() + w.size(), value);
+        if(w.empty() || ec != errc() || end != w.data() + w.size())
+            fail("expected a number, got '" + string(w) + "'");
+        return value;
+    }
+
+    void directive(string_view text) {
+        string_view key = word(text);
+        if(key == "gravity") {
+            gravity = number(text);
+        } else if(key == "material") {
+            text = trim(text);
+            if(text.size() < 3 || text[0] != '\'' || text[2] != '\'')
+                fail("expected a quoted symbol like '.'");
+            Material mat{text[1]};
+            text.remove_prefix(3);
+            while(!trim(text).empty()) {
+                string_view w = trim(text);
+                if(w[0] == '-' || w[0] == '.' || (w[0] >= '0' && w[0] <= '9')) {
+                    mat.rho = number(text);
+                    continue;
+                }
+                string_view attr = word(text);
+                if(attr == "wall")
+                    mat.wall = true;
+                else if(attr == "damping")
+                    mat.damping = number(text);
+                else if(attr == "p")
+                    mat.p = number(text);
+                else
+                    fail("unknown material attribute '" + string(attr) + "'");
+            }
+            materials.push_back(mat);
+        } else {
+            fail("unknown directive '" + string(key) + "'");
+        }
+    }
+
+    // Counts the rows and checks that they are equally wide; a trailing
+    // newline and '\r' line endings are allowed.
+    void scan_map() {
+        const char *pos = map_begin;
+        while(pos < file.end()) {
+            const char *eol = line_end(pos);
+            ++line;
+            size_t width = size_t(eol - pos);
+            if(width > 0 && pos[width - 1] == '\r')
+                --width;
+            if(rows == 0)
+                cols = width;
+            else if(width != cols)
+                fail("map row is " + to_string(width) + " wide, expected " + to_string(cols));
+            ++rows;
+            pos = next_line(eol);
+        }
+        if(rows == 0 || cols == 0)
+            fail("empty map");
+    }
+
+    string name;
+    MappedFile file;
+    const char *map_begin = nullptr;
+    size_t line = 0;
+};
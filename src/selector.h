@@ -3,6 +3,7 @@
 #include "simulator.h"
 
 #include "config.h"
+#include "options.h"
 
 template<typename T>
 struct is_fixed_type : std::false_type {};
@@ -16,11 +17,20 @@ struct is_fast_fixed_type : std::false_type {};
 template<size_t N, size_t K>
 struct is_fast_fixed_type<FastFixed<N,K>> : std::true_type {};
 
+// Storage-only types hold velocity and velocity_flow; pressure is never
+// instantiated with them.
+template<typename T>
+struct is_compact_fixed_type : std::false_type {};
+
+template<size_t N, size_t K>
+struct is_compact_fixed_type<CompactFixed<N,K>> : std::true_type {};
+
 inline bool validate_numeric_type(const std::string& type_str) {
     if(type_str == "FLOAT" || type_str == "DOUBLE") 
         return true;
         
-    if(type_str.starts_with("FIXED(") || type_str.starts_with("FAST_FIXED(")) {
+    if(type_str.starts_with("FIXED(") || type_str.starts_with("FAST_FIXED(") ||
+       type_str.starts_with("COMPACT_FIXED(")) {
         auto pos = type_str.find(',');
         return pos != std::string::npos && type_str.find(')', pos) != std::string::npos;
     }
@@ -53,10 +63,10 @@ inline std::pair<size_t, size_t> get_fixed_params(const std::string& type_str) {
 
 template<typename T>
 bool check_type_match(const std::string& type_str) {
-    if constexpr (std::is_same_v<T, float>) {
+    if constexpr (std::is_same_v<T, float> || std::is_same_v<T, Float>) {
         return type_str == "FLOAT";
     } 
-    else if constexpr (std::is_same_v<T, double>) {
+    else if constexpr (std::is_same_v<T, double> || std::is_same_v<T, Double>) {
         return type_str == "DOUBLE";
     }
     else if constexpr (is_fixed_type<T>::value) {
@@ -69,6 +79,11 @@ bool check_type_match(const std::string& type_str) {
         auto [bits, frac] = get_fixed_params(type_str);
         return bits == T::Bits && frac == T::Fraction;
     }
+    else if constexpr (is_compact_fixed_type<T>::value) {
+        if (!type_str.starts_with("COMPACT_FIXED(")) return false;
+        auto [bits, frac] = get_fixed_params(type_str);
+        return bits == T::Bits && frac == T::Fraction;
+    }
     return false;
 }
 
@@ -111,74 +126,99 @@ template<typename Types, typename Sizes>
 class SimulatorBuilder {
     template<typename P, typename V, typename VF, size_t N, size_t M>
     static bool try_create(const std::string& p_type, const std::string& v_type, 
-                          const std::string& vf_type, size_t n, size_t m) {
+                          const std::string& vf_type, size_t n, size_t m,
+                          const SimulationOptions& opts) {
         if (!check_type_match<P>(p_type) || 
             !check_type_match<V>(v_type) || 
             !check_type_match<VF>(vf_type)) {
             return false;
         }
         
-        Simulator<P, V, VF, N, M> sim;
-        sim.runSimulation();
+        // A checkpoint only fits the instantiation that wrote it; refuse a
+        // mismatch before the simulator maps anything.
+        if (!opts.resume.empty()) {
+            auto h = read_checkpoint_header(opts.resume);
+            if (!check_type_match<P>(type_name(h.p_type)) ||
+                !check_type_match<V>(type_name(h.v_type)) ||
+                !check_type_match<VF>(type_name(h.vf_type))) {
+                throw std::runtime_error("Checkpoint was written with P=" + type_name(h.p_type) +
+                                         " V=" + type_name(h.v_type) + " VF=" + type_name(h.vf_type));
+            }
+            if (h.n != n || h.m != m) {
+                throw std::runtime_error("Checkpoint grid is " + std::to_string(h.n) + "x" + std::to_string(h.m));
+            }
+        }
+
+        Simulator<P, V, VF, N, M> sim(n, m, opts);
+        sim.runSimulation(opts.ticks, opts.save_interval, opts.checkpoint);
         return true;
     }
 
 public:
     template<size_t I = 0>
     static bool try_pressure_types(const std::string& p_type, const std::string& v_type,
-                                 const std::string& vf_type, size_t n, size_t m) {
+                                 const std::string& vf_type, size_t n, size_t m,
+                                 const SimulationOptions& opts) {
         if constexpr (I >= Types::size) {
             return false;
         } else {
             using P = typename Types::template get<I>;
-            return try_velocity_types<P, 0>(p_type, v_type, vf_type, n, m) ||
-                   try_pressure_types<I + 1>(p_type, v_type, vf_type, n, m);
+            if constexpr (is_compact_fixed_type<P>::value) {
+                return try_pressure_types<I + 1>(p_type, v_type, vf_type, n, m, opts);
+            } else {
+                return try_velocity_types<P, 0>(p_type, v_type, vf_type, n, m, opts) ||
+                       try_pressure_types<I + 1>(p_type, v_type, vf_type, n, m, opts);
+            }
         }
     }
 
 private:
     template<typename P, size_t I>
     static bool try_velocity_types(const std::string& p_type, const std::string& v_type,
-                                 const std::string& vf_type, size_t n, size_t m) {
+                                 const std::string& vf_type, size_t n, size_t m,
+                                 const SimulationOptions& opts) {
         if constexpr (I >= Types::size) {
             return false;
         } else {
             using V = typename Types::template get<I>;
-            return try_flow_types<P, V, 0>(p_type, v_type, vf_type, n, m) ||
-                   try_velocity_types<P, I + 1>(p_type, v_type, vf_type, n, m);
+            return try_flow_types<P, V, 0>(p_type, v_type, vf_type, n, m, opts) ||
+                   try_velocity_types<P, I + 1>(p_type, v_type, vf_type, n, m, opts);
         }
     }
 
     template<typename P, typename V, typename VF, size_t I = 0>
     static bool try_sizes(const std::string& p_type, const std::string& v_type,
-                         const std::string& vf_type, size_t target_n, size_t target_m) {
+                         const std::string& vf_type, size_t target_n, size_t target_m,
+                         const SimulationOptions& opts) {
         if constexpr (I >= Sizes::count) {
-            return false;
+            return try_create<P, V, VF, 0, 0>(p_type, v_type, vf_type, target_n, target_m, opts);
         } else {
             constexpr std::pair<size_t, size_t> size = Sizes::template get<I>();
             if (size.first == target_n && size.second == target_m) {
-                return try_create<P, V, VF, size.first, size.second>(p_type, v_type, vf_type, size.first, size.second);
+                return try_create<P, V, VF, size.first, size.second>(p_type, v_type, vf_type, size.first, size.second, opts);
             }
-            return try_sizes<P, V, VF, I + 1>(p_type, v_type, vf_type, target_n, target_m);
+            return try_sizes<P, V, VF, I + 1>(p_type, v_type, vf_type, target_n, target_m, opts);
         }
     }
 
     template<typename P, typename V, size_t I>
     static bool try_flow_types(const std::string& p_type, const std::string& v_type,
-                              const std::string& vf_type, size_t n, size_t m) {
+                              const std::string& vf_type, size_t n, size_t m,
+                              const SimulationOptions& opts) {
         if constexpr (I >= Types::size) {
             return false;
         } else {
             using VF = typename Types::template get<I>;
-            return try_sizes<P, V, VF>(p_type, v_type, vf_type, n, m) ||
-                   try_flow_types<P, V, I + 1>(p_type, v_type, vf_type, n, m);
+            return try_sizes<P, V, VF>(p_type, v_type, vf_type, n, m, opts) ||
+                   try_flow_types<P, V, I + 1>(p_type, v_type, vf_type, n, m, opts);
         }
     }
 };
 
 template<typename CompiledTypes, typename CompiledSizes>
 bool create_simulator(const std::string& p_type, const std::string& v_type, 
-                     const std::string& vf_type, size_t n, size_t m) {
+                     const std::string& vf_type, size_t n, size_t m,
+                     const SimulationOptions& opts) {
     try {
         std::cerr << "Creating simulator with:\n"
                   << "Pressure type: " << p_type << "\n"
@@ -194,7 +234,7 @@ bool create_simulator(const std::string& p_type, const std::string& v_type,
         }
 
         return SimulatorBuilder<CompiledTypes, CompiledSizes>::try_pressure_types(
-            p_type, v_type, vf_type, n, m
+            p_type, v_type, vf_type, n, m, opts
         );
     }
     catch (const std::exception& e) {
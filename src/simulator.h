@@ -3,17 +3,30 @@
 using namespace std;
 
 #include "config.h"
+#include "checkpoint.h"
 #include <array>
+#include <bit>
 #include "Fixed.h"
 #include "FastFixed.h"
+#include "CompactFixed.h"
 #include "Double.h"
 #include "Float.h"
 #include "fixed_operators.h"
+#include "frame_output.h"
+#include "grid.h"
+#include "kernels.h"
+#include "options.h"
+#include "rng.h"
+#include "scenario.h"
+#include "thread_pool.h"
+#include "trajectory.h"
 #include <cassert>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <random>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 template <typename P, typename V, typename VFLOW, size_t S1, size_t S2>
@@ -23,14 +36,44 @@ public:
     static constexpr P inf = P::from_raw(numeric_limits<P>::max());
     static constexpr P eps = P::from_raw(numeric_limits<P>::min());
 
+    // Every TYPES combination the selector instantiates passes through here,
+    // so this checks that the V <-> P <-> VFLOW casts the sweeps make keep
+    // values that all of them can represent exactly.
+    static_assert(numeric_cast<P>(numeric_cast<V>(P(0.5))) == P(0.5));
+    static_assert(numeric_cast<P>(numeric_cast<VFLOW>(P(-3))) == P(-3));
+    static_assert(numeric_cast<V>(numeric_cast<VFLOW>(V(0.25))) == V(0.25));
+
+    enum Direction : size_t { Up = 0, Down = 1, Left = 2, Right = 3 };
+
+    static constexpr size_t dir_index(int dx, int dy) {
+        return dx != 0 ? size_t(dx + 1) / 2 : 2 + size_t(dy + 1) / 2;
+    }
+
+    static constexpr size_t opposite(size_t d) {
+        return d ^ 1;
+    }
+
+    template <typename F>
+    static void for_each_direction(F &&f) {
+        [&]<size_t... D>(index_sequence<D...>) {
+            (f(integral_constant<size_t, D>{}), ...);
+        }(make_index_sequence<4>{});
+    }
+
+    // With a storage-only T such as CompactFixed the planes hold the narrow
+    // values; T's own operators widen on every read and narrow on write.
     template <typename T>
     struct VectorFieldStatic {
-        array<T, 4> v[S1][S2];
+        Grid<T, S1, S2> v[4];
+
+        void bind(Arena &arena, size_t n, size_t m) {
+            for(auto &plane : v)
+                plane.bind(arena, n, m);
+        }
 
-        VectorFieldStatic() {
-            for(auto &row : v)
-                for(auto &cell : row)
-                    cell.fill(T(0));
+        void fill(T value) {
+            for(auto &plane : v)
+                plane.fill(value);
         }
 
         T& add(int x, int y, int dx, int dy, T dv) {
@@ -38,124 +81,755 @@ public:
         }
 
         T& get(int x, int y, int dx, int dy) {
-            size_t i = find(deltas.begin(), deltas.end(), pair(dx, dy)) - deltas.begin();
-            assert(i < deltas.size());
-            return v[x][y][i];
+            size_t i = dir_index(dx, dy);
+            assert(i < deltas.size() && deltas[i] == pair(dx, dy));
+            return v[i][x][y];
+        }
+
+        T& get(int x, int y, size_t d) {
+            return v[d][x][y];
+        }
+
+        template <size_t D>
+        T& get(int x, int y) {
+            static_assert(D < 4);
+            return v[D][x][y];
+        }
+
+        Grid<T, S1, S2>& plane(size_t d) {
+            return v[d];
+        }
+
+        void swap_cell(int x, int y, array<T, 4> &cell) {
+            for(size_t d = 0; d < 4; ++d)
+                swap(v[d][x][y], cell[d]);
+        }
+    };
+
+    // Vector field that is cleared in O(1): clear() bumps the epoch and a cell
+    // is zeroed the first time it is touched with a stale stamp.
+    template <typename T>
+    struct LazyVectorField : VectorFieldStatic<T> {
+        using Base = VectorFieldStatic<T>;
+
+        Grid<uint32_t, S1, S2> stamp;
+        uint32_t epoch = 0;
+
+        void bind(Arena &arena, size_t n, size_t m) {
+            Base::bind(arena, n, m);
+            stamp.bind(arena, n, m);
+        }
+
+        void fill(T value) {
+            Base::fill(value);
+            stamp.fill(epoch);
+        }
+
+        void clear() {
+            if(++epoch == 0) {
+                stamp.fill(0);
+                epoch = 1;
+            }
+        }
+
+        void touch(int x, int y) {
+            if(stamp[x][y] != epoch) {
+                stamp[x][y] = epoch;
+                for(auto &plane : this->v)
+                    plane[x][y] = T(0);
+            }
+        }
+
+        T& get(int x, int y, size_t d) {
+            touch(x, y);
+            return this->v[d][x][y];
+        }
+
+        template <size_t D>
+        T& get(int x, int y) {
+            touch(x, y);
+            return this->v[D][x][y];
+        }
+    };
+
+    // Per-cell visit state of the current propagation generation: Open while
+    // the cell is on a walk's path, Done once it is settled, Stale otherwise.
+    // A cell holds the 8-bit generation it was last marked in (gen - 1 for
+    // Open, gen for Done); next() steps gen by 2 and refills the grid before
+    // it would wrap, so stamps from 127 generations ago cannot alias.
+    struct VisitMap {
+        enum State : uint8_t { Stale, Open, Done };
+
+        Grid<uint8_t, S1, S2> stamp;
+        uint8_t gen = 2;
+
+        void bind(Arena &arena, size_t n, size_t m) {
+            stamp.bind(arena, n, m);
+        }
+
+        void reset() {
+            stamp.fill(0);
+            gen = 2;
+        }
+
+        // Returns true when the generation wrapped and every cell went Stale.
+        bool next() {
+            if(gen == 254) {
+                reset();
+                return true;
+            }
+            gen += 2;
+            return false;
+        }
+
+        bool stale(int x, int y) const {
+            return uint8_t(gen - stamp[x][y]) > 1;
+        }
+
+        bool open(int x, int y) const {
+            return stamp[x][y] == uint8_t(gen - 1);
+        }
+
+        bool done(int x, int y) const {
+            return stamp[x][y] == gen;
+        }
+
+        void set(int x, int y, State s) {
+            stamp[x][y] = s == Stale ? 0 : s == Open ? uint8_t(gen - 1) : gen;
+        }
+
+        uint8_t raw(int x, int y) const {
+            return stamp[x][y];
+        }
+
+        void restore(int x, int y, uint8_t value) {
+            stamp[x][y] = value;
         }
     };
 
     int N = S1;
     int M = S2;
-    int dirs[S1][S2];
+    Grid<int, S1, S2> dirs;
     VectorFieldStatic<V> velocity;
-    VectorFieldStatic<VFLOW> velocity_flow;
-    P rho[256];
-    P p[S1][S2];
-    P old_p[S1][S2];
-    int last_use[S1][S2];
-    int UT;
-    char field[S1][S2 + 1];
-
-    Simulator() : velocity(), velocity_flow(), UT(0) {
-        memset(dirs, 0, sizeof(dirs));
-        memset(p, 0, sizeof(p));
-        memset(old_p, 0, sizeof(old_p));
-        memset(last_use, 0, sizeof(last_use));
-        memset(field, 0, sizeof(field));
+    LazyVectorField<VFLOW> velocity_flow;
+    // Per-material properties indexed by the dense ids stored in field. The
+    // map symbols are translated once, in set_cell; the sweeps then read
+    // density, 1 / density and the velocity-apply damping with one indexed
+    // load and never compare characters. A new material is one add() call.
+    // The wall takes id 0, so a freshly filled field is all wall.
+    struct MaterialTable {
+        static constexpr uint8_t wall_id = 0;
+        static constexpr uint8_t air_id = 1;
+        static constexpr uint8_t fluid_id = 2;
+
+        size_t count = 0;
+        int16_t id_of[256];
+        char symbol[256];
+        P rho[256];
+        P inv_rho[256];
+        P damping[256];
+        uint8_t is_wall[256];
+
+        MaterialTable() {
+            fill(begin(id_of), end(id_of), int16_t(-1));
+            add('#', P(0), P(1), true);
+            add(' ', P(0));
+            add('.', P(0), P(0.8));
+        }
+
+        uint8_t add(char c, P density, P damp = P(1), bool wall = false) {
+            assert(id_of[(unsigned char)c] < 0 && count < 256);
+            uint8_t id = uint8_t(count++);
+            id_of[(unsigned char)c] = id;
+            symbol[id] = c;
+            rho[id] = density;
+            inv_rho[id] = 0;
+            damping[id] = damp;
+            is_wall[id] = wall;
+            return id;
+        }
+
+        // Symbols never seen before become plain materials with zero density.
+        uint8_t id(char c) {
+            int16_t known = id_of[(unsigned char)c];
+            return known >= 0 ? uint8_t(known) : add(c, P(0));
+        }
+    };
+    MaterialTable materials;
+    // Added to the downward velocity of every open cell on each tick.
+    P g = inf;
+    // 1 / dirs per open-neighbour count, so the sweeps multiply instead of
+    // divide. runSimulation rebuilds it together with materials.inv_rho; call
+    // rebuild_reciprocals() after changing a density in the middle of a run.
+    P inv_dirs[5];
+    Grid<P, S1, S2> p;
+    Grid<P, S1, S2> old_p;
+    VisitMap visits;
+    Grid<uint8_t, S1, S2> field;
+    // Fluid cells of each row as [y0, y1) runs, and per cell one bit per
+    // direction whose neighbour is not a wall (dirs is its popcount). Walls
+    // never move during a run; set_cell keeps both up to date otherwise.
+    vector<vector<pair<int, int>>> fluid_runs;
+    Grid<uint8_t, S1, S2> open_dirs;
+
+    // Prefix sums of the non-negative outgoing velocities of a cell, in the
+    // order pick_move samples them but without the visit filter. live has
+    // a bit per open direction with positive velocity. A table is built once
+    // per move phase (stamp == visits.gen) and dropped when swap_with rewrites
+    // the cell's velocity or the visit generation wraps.
+    struct MoveTable {
+        array<P, 4> cum;
+        uint8_t live;
+        uint8_t stamp;
+    };
+    Grid<MoveTable, S1, S2> move_tables;
+    Arena arena;
+
+    // Every field lives in one heap arena. With S1 == S2 == 0 the extents come
+    // from n and m; otherwise they must match the template arguments. With
+    // opts.resume the arena is mapped from that checkpoint instead, and
+    // opts.scenario is not loaded.
+    explicit Simulator(size_t n = S1, size_t m = S2, const SimulationOptions &opts = SimulationOptions())
+        : N(n), M(m), velocity(), velocity_flow() {
+        assert(S1 == 0 || (n == S1 && m == S2));
+        configure(opts);
+        if(!opts.resume.empty()) {
+            restore(opts.resume);
+            return;
+        }
+        Arena sizing;
+        bind_fields(sizing);
+        arena.reserve(sizing.size(), opts.huge_pages);
+        bind_fields(arena);
+
+        dirs.fill(0);
+        p.fill(P(0));
+        old_p.fill(P(0));
+        visits.reset();
+        field.fill(0);
+        open_dirs.fill(0);
+        velocity.fill(V(0));
+        velocity_flow.fill(VFLOW(0));
+        flow_push.fill(P(0));
+        move_tables.fill(MoveTable{});
+        if(opts.scenario)
+            load_scenario(*opts.scenario);
+    }
+
+    void bind_fields(Arena &a) {
+        dirs.bind(a, N, M);
+        velocity.bind(a, N, M);
+        velocity_flow.bind(a, N, M);
+        p.bind(a, N, M);
+        old_p.bind(a, N, M);
+        visits.bind(a, N, M);
+        field.bind(a, N, M);
+        open_dirs.bind(a, N, M);
+        flow_push.bind(a, N, M);
+        move_tables.bind(a, N, M);
+    }
+
+    void rebuild_reciprocals() {
+        for(size_t c = 0; c < materials.count; ++c)
+            materials.inv_rho[c] = materials.rho[c] == 0 ? P(0) : P(1) / materials.rho[c];
+        inv_dirs[0] = 0;
+        for(int k = 1; k < 5; ++k)
+            inv_dirs[k] = P(1) / P(k);
+    }
+
+    bool is_wall(int x, int y) const {
+        return materials.is_wall[field[x][y]];
+    }
+
+    bool is_open(int x, int y, size_t d) const {
+        return (open_dirs[x][y] >> d) & 1;
+    }
+
+    void rebuild_cell(int x, int y) {
+        uint8_t mask = 0;
+        if(!is_wall(x, y)) {
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                if(!is_wall(x + deltas[d].first, y + deltas[d].second))
+                    mask |= uint8_t(1) << d;
+            }
+        }
+        open_dirs[x][y] = mask;
+        dirs[x][y] = popcount(unsigned(mask));
+    }
+
+    void rebuild_row(int x) {
+        auto &runs = fluid_runs[x];
+        runs.clear();
+        for(int y = 0; y < M; ++y) {
+            if(is_wall(x, y))
+                continue;
+            if(!runs.empty() && runs.back().second == y)
+                ++runs.back().second;
+            else
+                runs.push_back({y, y + 1});
+        }
+    }
+
+    void rebuild_topology() {
+        fluid_runs.resize(N);
+        for(int x = 0; x < N; ++x) {
+            for(int y = 0; y < M; ++y)
+                rebuild_cell(x, y);
+            rebuild_row(x);
+        }
+    }
+
+    // Writes a cell of the map. Only a change between wall and non-wall
+    // touches the topology, and then just this cell, its neighbours and its
+    // row.
+    void set_cell(int x, int y, char c) {
+        bool was_wall = is_wall(x, y);
+        field[x][y] = materials.id(c);
+        if(was_wall == is_wall(x, y))
+            return;
+        rebuild_cell(x, y);
+        for(auto &[dx, dy] : deltas) {
+            int nx = x + dx, ny = y + dy;
+            if(nx >= 0 && nx < N && ny >= 0 && ny < M)
+                rebuild_cell(nx, ny);
+        }
+        if(!fluid_runs.empty())
+            rebuild_row(x);
+    }
+
+    // Takes materials, gravity, the map and starting pressures from a
+    // scenario of exactly N x M cells. Rows are translated from the mapped
+    // file straight into field; the topology is rebuilt by the next
+    // runSimulation, as after any edit made before it.
+    void load_scenario(const Scenario &s) {
+        if(s.rows != size_t(N) || s.cols != size_t(M))
+            throw runtime_error("Scenario is " + to_string(s.rows) + "x" + to_string(s.cols) +
+                                ", simulator is " + to_string(N) + "x" + to_string(M));
+        P start_p[256] = {};
+        bool any_p = false;
+        for(auto &mat : s.materials) {
+            uint8_t id = materials.id(mat.symbol);
+            if(mat.rho)
+                materials.rho[id] = P(*mat.rho);
+            if(mat.damping)
+                materials.damping[id] = P(*mat.damping);
+            if(mat.wall)
+                materials.is_wall[id] = true;
+            if(mat.p) {
+                start_p[id] = P(*mat.p);
+                any_p = true;
+            }
+        }
+        if(s.gravity)
+            g = P(*s.gravity);
+
+        // id_of only grows when a new symbol shows up, so the hot loop is a
+        // table lookup per byte.
+        s.for_each_row([&](size_t x, const char *row) {
+            uint8_t *out = field[x];
+            for(int y = 0; y < M; ++y)
+                out[y] = materials.id(row[y]);
+        });
+        if(any_p) {
+            for(int x = 0; x < N; ++x) {
+                for(int y = 0; y < M; ++y)
+                    p[x][y] = start_p[field[x][y]];
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each_fluid(size_t x0, size_t x1, F &&f) {
+        for(size_t x = x0; x < x1; ++x) {
+            for(auto [y0, y1] : fluid_runs[x]) {
+                for(int y = y0; y < y1; ++y)
+                    f(x, size_t(y));
+            }
+        }
     }
 
     struct ParticleParams {
-        char type;
+        uint8_t type;
         P cur_p;
         array<V, 4> v;
 
         void swap_with(Simulator &sim, int x, int y) {
             swap(sim.field[x][y], type);
             swap(sim.p[x][y], cur_p);
-            swap(sim.velocity.v[x][y], v);
+            sim.velocity.swap_cell(x, y, v);
+            sim.move_tables[x][y].stamp = 0;
         }
     };
 
+    struct FlowFrame {
+        int x, y;
+        P lim;
+        P ret;
+        size_t d;
+    };
+
+    struct MoveFrame {
+        int x, y;
+        int nx, ny;
+        bool is_first;
+    };
+
+    struct StopFrame {
+        int x, y;
+        size_t d;
+    };
+
+    // State of one move/stop walker. The sequential move phase uses
+    // serial_walk; the parallel one gives every region its own context whose
+    // walks are confined to the region's core [x0, x1) x [y0, y1).
+    struct WalkContext {
+        vector<MoveFrame> move_stack;
+        vector<StopFrame> stop_stack;
+
+        bool bounded = false;
+        int x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+        // Visit writes of the current walk as {x, y, old stamp}, replayed
+        // backwards when the walk has to be abandoned.
+        vector<tuple<int, int, uint8_t>> undo;
+        // Cells outside the core that a stop flood reached; the serial
+        // fix-up pass finishes them.
+        vector<pair<int, int>> deferred;
+        Rng rng;
+        bool moved = false;
+
+        bool inside(int x, int y) const {
+            return !bounded || (x >= x0 && x < x1 && y >= y0 && y < y1);
+        }
+    };
+
+    // Explicit DFS stacks shared by the propagate_* routines. A cell is pushed
+    // at most once per walk, so N * M frames is enough and they never realloc.
+    vector<FlowFrame> flow_stack;
+    WalkContext serial_walk;
+
+    void reserve_stacks() {
+        flow_stack.reserve(size_t(N) * M);
+        serial_walk.move_stack.reserve(size_t(N) * M);
+        serial_walk.stop_stack.reserve(size_t(N) * M);
+    }
+
+    void mark(WalkContext &ctx, int x, int y, typename VisitMap::State state) {
+        if(ctx.bounded)
+            ctx.undo.push_back({x, y, visits.raw(x, y)});
+        visits.set(x, y, state);
+    }
+
+    // Starts a new visit generation: every cell is Stale again.
+    void next_generation() {
+        if(visits.next())
+            for(size_t i = 0; i < move_tables.size(); ++i)
+                move_tables.data()[i].stamp = 0;
+    }
+
     tuple<P, bool, pair<int, int>> propagate_flow(int x, int y, P lim) {
-        last_use[x][y] = UT - 1;
-        P ret = 0;
-        for(auto &[dx, dy] : deltas) {
-            int nx = x + dx, ny = y + dy;
-            if(field[nx][ny] != '#' && last_use[nx][ny] < UT) {
-                auto cap = velocity.get(x, y, dx, dy);
-                auto flow = velocity_flow.get(x, y, dx, dy);
-                if(flow == cap)
+        auto &st = flow_stack;
+        st.clear();
+        st.push_back({x, y, lim, P(0), 0});
+        visits.set(x, y, VisitMap::Open);
+
+        tuple<P, bool, pair<int, int>> res;
+        bool returning = false;
+        while(true) {
+            size_t top = st.size() - 1;
+            if(returning) {
+                auto [t, prop, end] = res;
+                FlowFrame &f = st[top];
+                f.ret += t;
+                if(prop) {
+                    velocity_flow.get(f.x, f.y, f.d) += numeric_cast<VFLOW>(t);
+                    if(flow_worklist)
+                        flow_queue.push_back({f.x, f.y});
+                    visits.set(f.x, f.y, VisitMap::Done);
+                    res = {t, prop && end != pair(f.x, f.y), end};
+                    st.pop_back();
+                    if(st.empty())
+                        return res;
                     continue;
-                auto vp = min(lim, cap - flow);
-                if(last_use[nx][ny] == UT - 1) {
-                    velocity_flow.add(x, y, dx, dy, vp);
-                    last_use[nx][ny] = UT;
-                    return {vp, true, {nx, ny}};
                 }
-                auto [t, prop, end] = propagate_flow(nx, ny, vp);
-                ret += t;
-                if(prop) {
-                    velocity_flow.add(x, y, dx, dy, t);
-                    last_use[x][y] = UT;
-                    return {t, prop && end != pair(x, y), end};
+                ++f.d;
+                returning = false;
+            }
+
+            FlowFrame &f = st[top];
+            for(; f.d < deltas.size(); ++f.d) {
+                auto &[dx, dy] = deltas[f.d];
+                int nx = f.x + dx, ny = f.y + dy;
+                if(is_open(f.x, f.y, f.d) && !visits.done(nx, ny)) {
+                    auto cap = numeric_cast<VFLOW>(velocity.get(f.x, f.y, f.d));
+                    auto flow = velocity_flow.get(f.x, f.y, f.d);
+                    if(flow == cap)
+                        continue;
+                    auto vp = min(f.lim, numeric_cast<P>(cap - flow));
+                    if(visits.open(nx, ny)) {
+                        velocity_flow.get(f.x, f.y, f.d) += numeric_cast<VFLOW>(vp);
+                        if(flow_worklist)
+                            flow_queue.push_back({f.x, f.y});
+                        visits.set(nx, ny, VisitMap::Done);
+                        res = {vp, true, {nx, ny}};
+                        returning = true;
+                        break;
+                    }
+                    visits.set(nx, ny, VisitMap::Open);
+                    st.push_back({nx, ny, vp, P(0), 0});
+                    break;
                 }
             }
+            if(returning) {
+                st.pop_back();
+                if(st.empty())
+                    return res;
+                continue;
+            }
+            if(st.size() - 1 != top)
+                continue;
+
+            visits.set(f.x, f.y, VisitMap::Done);
+            res = {f.ret, false, {0, 0}};
+            returning = true;
+            st.pop_back();
+            if(st.empty())
+                return res;
         }
-        last_use[x][y] = UT;
-        return {ret, false, {0, 0}};
     }
 
-    void propagate_stop(int x, int y, bool force = false) {
-        if(!force) {
-            bool stop = true;
-            for(auto &[dx, dy] : deltas) {
-                int nx = x + dx, ny = y + dy;
-                if(field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > 0) {
-                    stop = false;
+    P residual(int x, int y, size_t d) {
+        return numeric_cast<P>(velocity.get(x, y, d) - numeric_cast<V>(velocity_flow.get(x, y, d)));
+    }
+
+    // Dinic-style blocking circulation from (x, y). f.d is the frame's
+    // current arc. Reaching a cell that is already on the stack closes a
+    // cycle, which gets its whole bottleneck at once; the walk then resumes
+    // past the bottleneck edge. A cell whose arcs run out is Done for the
+    // rest of the sweep, since residuals only shrink, so one sweep over the
+    // grid leaves no residual cycle. The circulation it ends with need not be
+    // the one the reference loop finds.
+    void cancel_cycles(int x, int y) {
+        auto &st = flow_stack;
+        st.clear();
+        st.push_back({x, y, P(0), P(0), 0});
+        visits.set(x, y, VisitMap::Open);
+        while(!st.empty()) {
+            FlowFrame &f = st.back();
+            int nx = 0, ny = 0;
+            for(; f.d < deltas.size(); ++f.d) {
+                nx = f.x + deltas[f.d].first;
+                ny = f.y + deltas[f.d].second;
+                if(is_open(f.x, f.y, f.d) && !visits.done(nx, ny) && residual(f.x, f.y, f.d) > 0)
                     break;
+            }
+            if(f.d == deltas.size()) {
+                visits.set(f.x, f.y, VisitMap::Done);
+                st.pop_back();
+                continue;
+            }
+            if(!visits.open(nx, ny)) {
+                visits.set(nx, ny, VisitMap::Open);
+                st.push_back({nx, ny, P(0), P(0), 0});
+                continue;
+            }
+
+            size_t first = st.size() - 1;
+            while(st[first].x != nx || st[first].y != ny)
+                --first;
+            size_t cut = first;
+            P bottleneck = residual(st[first].x, st[first].y, st[first].d);
+            for(size_t i = first + 1; i < st.size(); ++i) {
+                P r = residual(st[i].x, st[i].y, st[i].d);
+                if(r < bottleneck) {
+                    bottleneck = r;
+                    cut = i;
                 }
             }
-            if(!stop)
-                return;
+            for(size_t i = first; i < st.size(); ++i) {
+                auto cap = numeric_cast<VFLOW>(velocity.get(st[i].x, st[i].y, st[i].d));
+                auto &flow = velocity_flow.get(st[i].x, st[i].y, st[i].d);
+                flow += numeric_cast<VFLOW>(bottleneck);
+                if(flow > cap)
+                    flow = cap;
+            }
+            for(size_t i = cut + 1; i < st.size(); ++i)
+                visits.set(st[i].x, st[i].y, VisitMap::Stale);
+            st.resize(cut + 1);
+            ++st.back().d;
         }
-        last_use[x][y] = UT;
-        for(auto &[dx, dy] : deltas) {
-            int nx = x + dx, ny = y + dy;
-            if(field[nx][ny] == '#' || last_use[nx][ny] == UT || velocity.get(x, y, dx, dy) > 0)
+    }
+
+    FlowSolver flow_solver = FlowSolver::Reference;
+
+    // Worklist mode for the reference solver. A cycle left after a pass has
+    // to run through a cell whose residual that pass changed (otherwise the
+    // pass would have found it), so after the first full sweep only those
+    // cells are restarted, in the same row-major order. The start order
+    // differs from the full sweep, so the circulation may too.
+    bool flow_worklist = false;
+    vector<pair<int, int>> flow_queue;
+    vector<pair<int, int>> flow_starts;
+    size_t flow_passes = 0;
+    size_t flow_visits = 0;
+    size_t flow_sweep_visits = 0;
+
+    // Fills velocity_flow for this tick with the selected solver.
+    void solve_flow() {
+        if(flow_solver == FlowSolver::Dinic) {
+            next_generation();
+            for_each_live(0, N, [&](size_t x, size_t y) {
+                if(!visits.done(x, y))
+                    cancel_cycles(x, y);
+            });
+            return;
+        }
+
+        bool prop = false;
+        bool sweep = true;
+        size_t live = 0;
+        flow_queue.clear();
+        do {
+            next_generation();
+            prop = false;
+            auto start = [&](size_t x, size_t y) {
+                if(!visits.done(x, y)) {
+                    auto [t, local_prop, _] = propagate_flow(x, y, 1);
+                    if(t > 0)
+                        prop = true;
+                }
+            };
+            if(sweep) {
+                live = 0;
+                for_each_live(0, N, [&](size_t x, size_t y) {
+                    ++live;
+                    start(x, y);
+                });
+                flow_visits += live;
+                sweep = !flow_worklist;
+            }
+            else {
+                flow_starts.swap(flow_queue);
+                flow_queue.clear();
+                sort(flow_starts.begin(), flow_starts.end());
+                flow_starts.erase(unique(flow_starts.begin(), flow_starts.end()), flow_starts.end());
+                for(auto [x, y] : flow_starts)
+                    start(x, y);
+                flow_visits += flow_starts.size();
+            }
+            ++flow_passes;
+            flow_sweep_visits += live;
+        } while(prop);
+    }
+
+    bool should_stop(int x, int y) {
+        for(size_t d = 0; d < deltas.size(); ++d) {
+            int nx = x + deltas[d].first, ny = y + deltas[d].second;
+            if(is_open(x, y, d) && visits.stale(nx, ny) && velocity.get(x, y, d) > 0)
+                return false;
+        }
+        return true;
+    }
+
+    void propagate_stop(WalkContext &ctx, int x, int y, bool force = false) {
+        if(!ctx.inside(x, y)) {
+            ctx.deferred.push_back({x, y});
+            return;
+        }
+        if(!force && !should_stop(x, y))
+            return;
+        auto &st = ctx.stop_stack;
+        st.clear();
+        mark(ctx, x, y, VisitMap::Done);
+        st.push_back({x, y, 0});
+        while(!st.empty()) {
+            StopFrame &f = st.back();
+            if(f.d == deltas.size()) {
+                st.pop_back();
                 continue;
-            propagate_stop(nx, ny);
+            }
+            size_t d = f.d++;
+            int nx = f.x + deltas[d].first, ny = f.y + deltas[d].second;
+            if(!is_open(f.x, f.y, d) || visits.done(nx, ny) || velocity.get(f.x, f.y, d) > 0)
+                continue;
+            if(!ctx.inside(nx, ny)) {
+                ctx.deferred.push_back({nx, ny});
+                continue;
+            }
+            if(!should_stop(nx, ny))
+                continue;
+            mark(ctx, nx, ny, VisitMap::Done);
+            st.push_back({nx, ny, 0});
+        }
+    }
+
+    void propagate_stop(int x, int y, bool force = false) {
+        propagate_stop(serial_walk, x, y, force);
+    }
+
+    const MoveTable &move_table(int x, int y) {
+        MoveTable &t = move_tables[x][y];
+        if(t.stamp != visits.gen) {
+            P sum = 0;
+            t.live = 0;
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                if(is_open(x, y, d)) {
+                    auto v = velocity.get(x, y, d);
+                    if(!(v < 0))
+                        sum += v;
+                    if(v > 0)
+                        t.live |= uint8_t(1) << d;
+                }
+                t.cum[d] = sum;
+            }
+            t.stamp = visits.gen;
+        }
+        return t;
+    }
+
+    // A cached table only matches the filtered sum while no direction that
+    // carries probability leads to a cell already settled this tick.
+    bool table_blocked(const MoveTable &t, int x, int y) const {
+        for(unsigned m = t.live; m; m &= m - 1) {
+            size_t d = countr_zero(m);
+            if(visits.done(x + deltas[d].first, y + deltas[d].second))
+                return true;
         }
+        return false;
     }
 
     P move_prob(int x, int y) {
+        auto &t = move_table(x, y);
+        if(!table_blocked(t, x, y))
+            return t.cum[3];
         P sum = 0;
-        for(auto &[dx, dy] : deltas) {
-            int nx = x + dx, ny = y + dy;
-            if(field[nx][ny] == '#' || last_use[nx][ny] == UT)
-                continue;
-            auto v = velocity.get(x, y, dx, dy);
+        for_each_direction([&](auto d) {
+            int nx = x + deltas[d].first, ny = y + deltas[d].second;
+            if(!is_open(x, y, d) || visits.done(nx, ny))
+                return;
+            auto v = velocity.template get<d>(x, y);
             if(v < 0)
-                continue;
+                return;
             sum += v;
-        }
+        });
         return sum;
     }
 
-    bool propagate_move(int x, int y, bool is_first) {
-        last_use[x][y] = UT - is_first;
-        bool ret = false;
-        int nx = -1, ny = -1;
-        do {
-            array<P, 4> tres;
-            P sum = 0;
+    // Picks the next step of a random walk from (x, y), or returns false when
+    // no outgoing edge is left.
+    bool pick_move(WalkContext &ctx, int x, int y, int &nx, int &ny) {
+        auto &t = move_table(x, y);
+        array<P, 4> tres = t.cum;
+        P sum = tres[3];
+        if(table_blocked(t, x, y)) {
+            sum = 0;
             for(size_t i = 0; i < deltas.size(); ++i) {
                 auto &[dx, dy] = deltas[i];
                 int nx = x + dx, ny = y + dy;
-                if(field[nx][ny] == '#' || last_use[nx][ny] == UT) {
+                if(!is_open(x, y, i) || visits.done(nx, ny)) {
                     tres[i] = sum;
                     continue;
                 }
-                auto v = velocity.get(x, y, dx, dy);
+                auto v = velocity.get(x, y, i);
                 if(v < 0) {
                     tres[i] = sum;
                     continue;
@@ -163,153 +837,793 @@ public:
                 sum += v;
                 tres[i] = sum;
             }
+        }
 
-            if(sum == 0)
-                break;
+        if(sum == 0)
+            return false;
 
-            P p_val = (rand() % 1000000) / 1000000.0;
-            P p_scaled = sum * p_val;
-            size_t d = upper_bound(tres.begin(), tres.end(), p_scaled) - tres.begin();
+        P p_val = ctx.rng.template uniform01<P>();
+        P p_scaled = sum * p_val;
+        size_t d = upper_bound(tres.begin(), tres.end(), p_scaled) - tres.begin();
 
-            auto &[dx, dy] = deltas[d];
-            nx = x + dx;
-            ny = y + dy;
-            assert(velocity.get(x, y, dx, dy) > 0 && field[nx][ny] != '#' && last_use[nx][ny] < UT);
+        auto &[dx, dy] = deltas[d];
+        nx = x + dx;
+        ny = y + dy;
+        assert(velocity.get(x, y, d) > 0 && !is_wall(nx, ny) && !visits.done(nx, ny));
+        return true;
+    }
 
-            ret = (last_use[nx][ny] == UT - 1 || propagate_move(nx, ny, false));
-        } while(!ret);
-        last_use[x][y] = UT;
-        for(auto &[dx, dy] : deltas) {
-            int nx = x + dx, ny = y + dy;
-            if(field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) < 0) {
-                propagate_stop(nx, ny);
+    void finish_move(WalkContext &ctx, const MoveFrame &f, bool ret) {
+        mark(ctx, f.x, f.y, VisitMap::Done);
+        for(size_t d = 0; d < deltas.size(); ++d) {
+            int nx = f.x + deltas[d].first, ny = f.y + deltas[d].second;
+            if(is_open(f.x, f.y, d) && visits.stale(nx, ny) && velocity.get(f.x, f.y, d) < 0) {
+                propagate_stop(ctx, nx, ny);
             }
         }
-        if(ret && !is_first) {
+        if(ret && !f.is_first) {
             ParticleParams pp{};
-            pp.swap_with(*this, x, y);
-            pp.swap_with(*this, nx, ny);
-            pp.swap_with(*this, x, y);
+            pp.swap_with(*this, f.x, f.y);
+            pp.swap_with(*this, f.nx, f.ny);
+            pp.swap_with(*this, f.x, f.y);
         }
-        return ret;
     }
 
-    void runSimulation(size_t T=500, size_t save_interval=0, const string &file_name="") {
-        if(rho[' '] == 0 || inf == 0)
-            return;
+    // Returns false both when the walk found no cycle and when a bounded walk
+    // had to leave its region; the latter is rolled back and flagged in
+    // conflict so the caller can retry the start cell serially.
+    bool propagate_move(WalkContext &ctx, int x, int y, bool is_first, bool *conflict = nullptr) {
+        auto &st = ctx.move_stack;
+        st.clear();
+        ctx.undo.clear();
+        size_t deferred_mark = ctx.deferred.size();
+        st.push_back({x, y, -1, -1, is_first});
+        mark(ctx, x, y, is_first ? VisitMap::Open : VisitMap::Done);
 
-        for(size_t x = 0; x < N; ++x) {
-            for(size_t y = 0; y < M; ++y) {
-                if(field[x][y] == '#')
+        bool ret = false;
+        bool returning = false;
+        while(true) {
+            MoveFrame &f = st.back();
+            if(!returning || !ret) {
+                if(!pick_move(ctx, f.x, f.y, f.nx, f.ny)) {
+                    ret = false;
+                }
+                else if(visits.open(f.nx, f.ny)) {
+                    ret = true;
+                }
+                else if(!ctx.inside(f.nx, f.ny)) {
+                    for(auto it = ctx.undo.rbegin(); it != ctx.undo.rend(); ++it)
+                        visits.restore(get<0>(*it), get<1>(*it), get<2>(*it));
+                    ctx.undo.clear();
+                    ctx.deferred.resize(deferred_mark);
+                    st.clear();
+                    if(conflict)
+                        *conflict = true;
+                    return false;
+                }
+                else {
+                    st.push_back({f.nx, f.ny, -1, -1, false});
+                    mark(ctx, st.back().x, st.back().y, VisitMap::Done);
+                    returning = false;
                     continue;
-                for(auto &[dx, dy] : deltas) {
-                    dirs[x][y] += (field[x + dx][y + dy] != '#');
                 }
             }
+            finish_move(ctx, f, ret);
+            st.pop_back();
+            if(st.empty())
+                return ret;
+            returning = true;
         }
+    }
 
-        for(size_t i = 0; i < T; ++i) {
-            P total_delta_p = 0;
-            for(size_t x = 0; x < N; ++x) {
-                for(size_t y = 0; y < M; ++y) {
-                    if(field[x][y] == '#')
-                        continue;
-                    if(field[x + 1][y] != '#')
-                        velocity.add(x, y, 1, 0, inf);
-                }
+    bool propagate_move(int x, int y, bool is_first) {
+        return propagate_move(serial_walk, x, y, is_first);
+    }
+
+    static constexpr int move_tile = 32;
+
+    bool parallel_move = false;
+    Rng region_streams;
+    vector<WalkContext> region_walks;
+    array<vector<size_t>, 4> region_colours;
+
+    // Splits the grid into move_tile x move_tile regions coloured like a 2x2
+    // checkerboard. Regions of one colour never touch, and every walk stays
+    // in its region's core (the tile minus a one-cell rim), so all regions of
+    // a colour can run at once.
+    void setup_regions() {
+        region_walks.clear();
+        for(auto &c : region_colours)
+            c.clear();
+        for(int tx = 0; tx * move_tile < N; ++tx) {
+            for(int ty = 0; ty * move_tile < M; ++ty) {
+                WalkContext ctx;
+                ctx.bounded = true;
+                ctx.x0 = tx * move_tile + 1;
+                ctx.x1 = min(N, (tx + 1) * move_tile) - 1;
+                ctx.y0 = ty * move_tile + 1;
+                ctx.y1 = min(M, (ty + 1) * move_tile) - 1;
+                ctx.rng = region_streams.split();
+                ctx.move_stack.reserve(size_t(move_tile) * move_tile);
+                ctx.stop_stack.reserve(size_t(move_tile) * move_tile);
+                region_colours[(tx & 1) + 2 * (ty & 1)].push_back(region_walks.size());
+                region_walks.push_back(move(ctx));
             }
+        }
+    }
 
-            memcpy(old_p, p, sizeof(p));
-            for(size_t x = 0; x < N; ++x) {
-                for(size_t y = 0; y < M; ++y) {
-                    if(field[x][y] == '#')
+    void run_region_moves(WalkContext &ctx) {
+        ctx.moved = false;
+        ctx.deferred.clear();
+        for(int x = ctx.x0; x < ctx.x1; ++x) {
+            for(auto [y0, y1] : fluid_runs[x]) {
+                for(int y = max(y0, ctx.y0); y < min(y1, ctx.y1); ++y) {
+                    if(visits.done(x, y) || !cell_live(x, y))
                         continue;
-                    for(auto &[dx, dy] : deltas) {
-                        int nx = x + dx, ny = y + dy;
-                        if(field[nx][ny] != '#' && old_p[nx][ny] < old_p[x][y]) {
-                            auto delta_p = old_p[x][y] - old_p[nx][ny];
-                            auto force = delta_p;
-                            auto &contr = velocity.get(nx, ny, -dx, -dy);
-                            if(force <= contr * rho[(int)field[nx][ny]]) {
-                                contr -= force / rho[(int)field[nx][ny]];
-                                continue;
-                            }
-                            force -= contr * rho[(int)field[nx][ny]];
-                            contr = 0;
-                            velocity.add(x, y, dx, dy, force / rho[(int)field[x][y]]);
-                            p[x][y] -= force / dirs[x][y];
-                            total_delta_p -= force / dirs[x][y];
-                        }
+                    ctx.undo.clear();
+                    if(move_prob(x, y) > ctx.rng.template uniform01<P>()) {
+                        bool conflict = false;
+                        propagate_move(ctx, x, y, true, &conflict);
+                        ctx.moved |= !conflict;
+                    }
+                    else {
+                        propagate_stop(ctx, x, y, true);
                     }
                 }
             }
+        }
+    }
 
-            velocity_flow = VectorFieldStatic<VFLOW>();
-            bool prop = false;
-            do {
-                UT += 2;
-                prop = false;
-                for(size_t x = 0; x < N; ++x) {
-                    for(size_t y = 0; y < M; ++y) {
-                        if(field[x][y] != '#' && last_use[x][y] != UT) {
-                            auto [t, local_prop, _] = propagate_flow(x, y, 1);
-                            if(t > 0)
-                                prop = true;
-                        }
-                    }
+    void move_cell(int x, int y, bool &prop) {
+        if(!visits.done(x, y)) {
+            if(move_prob(x, y) > serial_walk.rng.template uniform01<P>()) {
+                prop = true;
+                propagate_move(x, y, true);
+            }
+            else {
+                propagate_stop(x, y, true);
+            }
+        }
+    }
+
+    // Runs region cores colour by colour, then finishes serially in a fixed
+    // order: deferred stop floods first, then every cell not yet settled
+    // this tick (region rims and walks that were rolled back). The result
+    // depends on the seed but not on the number of threads.
+    bool move_regions() {
+        if(region_walks.empty())
+            setup_regions();
+        for(auto &colour : region_colours) {
+            pool->parallel_for(colour.size(), [&](size_t i) {
+                run_region_moves(region_walks[colour[i]]);
+            });
+        }
+
+        bool prop = false;
+        for(auto &ctx : region_walks) {
+            prop |= ctx.moved;
+            for(auto [x, y] : ctx.deferred) {
+                if(!is_wall(x, y) && !visits.done(x, y))
+                    propagate_stop(x, y);
+            }
+        }
+        for_each_live(0, N, [&](size_t x, size_t y) {
+            move_cell(x, y, prop);
+        });
+        return prop;
+    }
+
+    static constexpr int sparse_tile = 32;
+
+    // Sparse mode: a tile whose p, velocity and field signature came out of
+    // the last quiet_ticks ticks unchanged, with all eight neighbour tiles
+    // likewise, is treated as settled and skipped by the gravity, gradient,
+    // flow-start, velocity-apply and move sweeps. Writes from live neighbours
+    // still land in it and wake it up at the end of the tick.
+    static constexpr uint8_t quiet_ticks = 2;
+
+    bool sparse = false;
+    bool verify_sparse = false;
+    bool skip_tiles = false;
+    int tiles_x = 0, tiles_y = 0;
+    vector<uint64_t> tile_sig;
+    vector<uint8_t> tile_quiet;
+    vector<uint8_t> tile_active;
+    size_t sparse_mismatches = 0;
+
+    size_t tile_of(int x, int y) const {
+        return size_t(x / sparse_tile) * tiles_y + y / sparse_tile;
+    }
+
+    bool cell_live(int x, int y) const {
+        return !skip_tiles || tile_active[tile_of(x, y)];
+    }
+
+    template <typename T>
+    static void hash_bytes(uint64_t &h, const T &value) {
+        unsigned char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        for(unsigned char b : bytes)
+            h = (h ^ b) * 0x100000001b3;
+    }
+
+    uint64_t tile_signature(int tx, int ty) {
+        uint64_t h = 0xcbf29ce484222325;
+        for(int x = tx * sparse_tile; x < min(N, (tx + 1) * sparse_tile); ++x) {
+            for(int y = ty * sparse_tile; y < min(M, (ty + 1) * sparse_tile); ++y) {
+                hash_bytes(h, field[x][y]);
+                hash_bytes(h, p[x][y]);
+                for(size_t d = 0; d < deltas.size(); ++d)
+                    hash_bytes(h, velocity.get(x, y, d));
+            }
+        }
+        return h;
+    }
+
+    void setup_tiles() {
+        tiles_x = (N + sparse_tile - 1) / sparse_tile;
+        tiles_y = (M + sparse_tile - 1) / sparse_tile;
+        tile_sig.assign(size_t(tiles_x) * tiles_y, 0);
+        tile_quiet.assign(tile_sig.size(), 0);
+        tile_active.assign(tile_sig.size(), 1);
+        for(int tx = 0; tx < tiles_x; ++tx)
+            for(int ty = 0; ty < tiles_y; ++ty)
+                tile_sig[size_t(tx) * tiles_y + ty] = tile_signature(tx, ty);
+        skip_tiles = sparse && !verify_sparse;
+        sparse_mismatches = 0;
+    }
+
+    // Run after every tick. Under --verify-sparse the tick was dense, and any
+    // tile the sparse plan would have skipped must have come out unchanged;
+    // otherwise skipping it would have diverged from the dense result.
+    void update_tiles(size_t tick) {
+        for(int tx = 0; tx < tiles_x; ++tx) {
+            for(int ty = 0; ty < tiles_y; ++ty) {
+                size_t t = size_t(tx) * tiles_y + ty;
+                uint64_t sig = tile_signature(tx, ty);
+                bool same = sig == tile_sig[t];
+                tile_sig[t] = sig;
+                tile_quiet[t] = same ? uint8_t(min(255, tile_quiet[t] + 1)) : 0;
+                if(verify_sparse && !tile_active[t] && !same) {
+                    ++sparse_mismatches;
+                    cerr << "sparse mismatch: tick " << tick << ", tile (" << tx << ", " << ty << ")\n";
                 }
-            } while(prop);
+            }
+        }
+        for(int tx = 0; tx < tiles_x; ++tx) {
+            for(int ty = 0; ty < tiles_y; ++ty) {
+                bool active = false;
+                for(int ax = max(0, tx - 1); ax <= min(tiles_x - 1, tx + 1); ++ax)
+                    for(int ay = max(0, ty - 1); ay <= min(tiles_y - 1, ty + 1); ++ay)
+                        active |= tile_quiet[size_t(ax) * tiles_y + ay] < quiet_ticks;
+                tile_active[size_t(tx) * tiles_y + ty] = active;
+            }
+        }
+    }
 
-            for(size_t x = 0; x < N; ++x) {
-                for(size_t y = 0; y < M; ++y) {
-                    if(field[x][y] == '#')
-                        continue;
-                    for(auto &[dx, dy] : deltas) {
-                        auto old_v = velocity.get(x, y, dx, dy);
-                        auto new_v = velocity_flow.get(x, y, dx, dy);
-                        if(old_v > 0) {
-                            assert(new_v <= old_v);
-                            velocity.get(x, y, dx, dy) = new_v;
-                            auto force = (old_v - new_v) * rho[(int)field[x][y]];
-                            if(field[x][y] == '.')
-                                force *= P(0.8);
-                            if(field[x + dx][y + dy] == '#') {
-                                p[x][y] += force / dirs[x][y];
-                                total_delta_p += force / dirs[x][y];
-                            }
-                            else {
-                                p[x + dx][y + dy] += force / dirs[x + dx][y + dy];
-                                total_delta_p += force / dirs[x + dx][y + dy];
-                            }
-                        }
-                    }
+    // Calls f(x, y0, y1) for the fluid runs of rows [x0, x1), cut down to
+    // live tiles.
+    template <typename F>
+    void for_each_live_run(size_t x0, size_t x1, F &&f) {
+        for(size_t x = x0; x < x1; ++x) {
+            size_t row = size_t(x / sparse_tile) * tiles_y;
+            for(auto [y0, y1] : fluid_runs[x]) {
+                if(!skip_tiles) {
+                    f(x, y0, y1);
+                    continue;
+                }
+                for(int y = y0; y < y1;) {
+                    int end = min(y1, (y / sparse_tile + 1) * sparse_tile);
+                    if(tile_active[row + y / sparse_tile])
+                        f(x, y, end);
+                    y = end;
                 }
             }
+        }
+    }
 
-            UT += 2;
-            prop = false;
-            for(size_t x = 0; x < N; ++x) {
-                for(size_t y = 0; y < M; ++y) {
-                    if(field[x][y] != '#' && last_use[x][y] != UT) {
-                        if(move_prob(x, y) > (rand() % 1000000) / 1000000.0) {
-                            prop = true;
-                            propagate_move(x, y, true);
-                        }
-                        else {
-                            propagate_stop(x, y, true);
-                        }
-                    }
+    // for_each_fluid restricted to live tiles.
+    template <typename F>
+    void for_each_live(size_t x0, size_t x1, F &&f) {
+        if(!skip_tiles) {
+            for_each_fluid(x0, x1, f);
+            return;
+        }
+        for_each_live_run(x0, x1, [&](size_t x, int y0, int y1) {
+            for(int y = y0; y < y1; ++y)
+                f(x, size_t(y));
+        });
+    }
+
+    static constexpr size_t band_rows = 16;
+
+    unique_ptr<ThreadPool> pool = make_unique<ThreadPool>(1);
+    VectorFieldStatic<P> flow_push;
+    vector<P> band_delta_p;
+
+    void configure(const SimulationOptions &opts) {
+        pool = make_unique<ThreadPool>(opts.threads);
+        parallel_move = opts.parallel_move;
+        sparse = opts.sparse || opts.verify_sparse;
+        verify_sparse = opts.verify_sparse;
+        flow_solver = opts.flow_solver;
+        flow_worklist = opts.flow_worklist;
+        simd = simd_types && opts.kernel == Kernel::Simd && simd_supported();
+        seed_streams(opts.seed);
+        render_every = opts.render_every;
+        frames = make_unique<FrameWriter>(opts.render_async);
+        trajectory_out.reset();
+        if(!opts.trajectory.empty()) {
+            trajectory::Header h;
+            h.n = N;
+            h.m = M;
+            h.planes = (opts.trajectory_p ? trajectory::Pressure : 0)
+                       | (opts.trajectory_velocity ? trajectory::Velocity : 0);
+            h.keyframe_every = opts.keyframe_every;
+            trajectory_out = make_unique<trajectory::Writer>(opts.trajectory, h);
+            trajectory_state.resize(h.state_size());
+        }
+    }
+
+    // A frame is produced on every tick in which a particle moved; only one
+    // in render_every of them is formatted and written.
+    size_t render_every = 1;
+    size_t frame_count = 0;
+    unique_ptr<FrameWriter> frames;
+
+    unique_ptr<trajectory::Writer> trajectory_out;
+    vector<uint8_t> trajectory_state;
+
+    // Packs this tick's state in the layout trajectory.h describes and
+    // appends it as one record.
+    void record_tick(size_t tick) {
+        auto &h = trajectory_out->format();
+        uint8_t *out = trajectory_state.data();
+        for(int x = 0; x < N; ++x) {
+            for(int y = 0; y < M; ++y)
+                *out++ = uint8_t(materials.symbol[field[x][y]]);
+        }
+        auto put = [&](double value) {
+            memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        };
+        if(h.planes & trajectory::Pressure) {
+            for(int x = 0; x < N; ++x) {
+                for(int y = 0; y < M; ++y)
+                    put(numeric_cast<double>(p[x][y]));
+            }
+        }
+        if(h.planes & trajectory::Velocity) {
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                for(int x = 0; x < N; ++x) {
+                    for(int y = 0; y < M; ++y)
+                        put(numeric_cast<double>(velocity.get(x, y, d)));
                 }
             }
+        }
+        trajectory_out->record(tick, trajectory_state);
+    }
+
+    void render_frame() {
+        if(render_every == 0 || frame_count++ % render_every != 0)
+            return;
+        frames->frame(N, M, [&](size_t x, size_t y) {
+            return materials.symbol[field[x][y]];
+        });
+    }
+
+    // The serial walker draws from the first stream of the seed; regions get
+    // the following ones in region order.
+    void seed_streams(uint64_t seed) {
+        Rng root(seed);
+        serial_walk.rng = root.split();
+        region_streams = root;
+        region_walks.clear();
+    }
+
+    size_t bands() const {
+        return (size_t(N) + band_rows - 1) / band_rows;
+    }
+
+    size_t band_begin(size_t b) const {
+        return b * band_rows;
+    }
+
+    size_t band_end(size_t b) const {
+        return min(size_t(N), (b + 1) * band_rows);
+    }
 
-            if(prop) {
-                for(size_t x = 0; x < N; ++x) {
-                    for(size_t y = 0; y < M; ++y) {
-                        cout << field[x][y];
+    // Every edge is written by at most one of its endpoints here: the cell
+    // with the higher old_p, so row bands can run concurrently as is. p and
+    // old_p were just swapped, so each cell starts from its old_p value.
+    P pressure_gradient_rows(size_t x0, size_t x1) {
+        P total = 0;
+        for(size_t row = x0; row < x1; ++row) {
+            if constexpr(simd_types) {
+                if(simd && row > 0 && row + 1 < size_t(N)) {
+                    total -= pressure_gradient_row_simd(row);
+                    continue;
+                }
+            }
+            for_each_fluid(row, row + 1, [&](size_t x, size_t y) {
+                p[x][y] = old_p[x][y];
+                if(!cell_live(x, y))
+                    return;
+                for_each_direction([&](auto d) {
+                    int nx = x + deltas[d].first, ny = y + deltas[d].second;
+                    if(is_open(x, y, d) && old_p[nx][ny] < old_p[x][y]) {
+                        auto delta_p = old_p[x][y] - old_p[nx][ny];
+                        auto force = delta_p;
+                        auto &contr = velocity.template get<opposite(d)>(nx, ny);
+                        P cr = numeric_cast<P>(contr) * materials.rho[field[nx][ny]];
+                        if(force <= cr) {
+                            contr -= numeric_cast<V>(force * materials.inv_rho[field[nx][ny]]);
+                            return;
+                        }
+                        force -= cr;
+                        contr = 0;
+                        velocity.template get<d>(x, y) += numeric_cast<V>(force * materials.inv_rho[field[x][y]]);
+                        P share = force * inv_dirs[dirs[x][y]];
+                        p[x][y] -= share;
+                        total -= share;
+                    }
+                });
+            });
+        }
+        return total;
+    }
+
+    P apply_flow_rows(size_t x0, size_t x1) {
+        P total = 0;
+        for_each_live(x0, x1, [&](size_t x, size_t y) {
+            for_each_direction([&](auto d) {
+                constexpr int dx = deltas[d].first, dy = deltas[d].second;
+                auto old_v = velocity.template get<d>(x, y);
+                auto new_v = velocity_flow.template get<d>(x, y);
+                if(old_v > 0) {
+                    assert(numeric_cast<V>(new_v) <= old_v);
+                    velocity.template get<d>(x, y) = numeric_cast<V>(new_v);
+                    auto force = numeric_cast<P>(old_v - numeric_cast<V>(new_v)) * materials.rho[field[x][y]];
+                    force *= materials.damping[field[x][y]];
+                    if(!is_open(x, y, d)) {
+                        P share = force * inv_dirs[dirs[x][y]];
+                        p[x][y] += share;
+                        total += share;
+                    }
+                    else {
+                        P share = force * inv_dirs[dirs[x + dx][y + dy]];
+                        p[x + dx][y + dy] += share;
+                        total += share;
                     }
-                    cout << "\n";
+                }
+            });
+        });
+        return total;
+    }
+
+    // First half of the threaded velocity apply: every cell updates its own
+    // velocity and records the pressure it hands to each target cell, without
+    // touching p.
+    void compute_flow_push(size_t x0, size_t x1) {
+        for(size_t row = x0; row < x1; ++row) {
+            if constexpr(simd_types) {
+                if(simd && row > 0 && row + 1 < size_t(N)) {
+                    compute_flow_push_row_simd(row);
+                    continue;
                 }
             }
+            for_each_fluid(row, row + 1, [&](size_t x, size_t y) {
+                if(!cell_live(x, y)) {
+                    for(size_t d = 0; d < deltas.size(); ++d)
+                        flow_push.get(x, y, d) = 0;
+                    return;
+                }
+                for_each_direction([&](auto d) {
+                    constexpr int dx = deltas[d].first, dy = deltas[d].second;
+                    auto &push = flow_push.template get<d>(x, y);
+                    auto old_v = velocity.template get<d>(x, y);
+                    auto new_v = velocity_flow.template get<d>(x, y);
+                    if(old_v > 0) {
+                        assert(numeric_cast<V>(new_v) <= old_v);
+                        velocity.template get<d>(x, y) = numeric_cast<V>(new_v);
+                        auto force = numeric_cast<P>(old_v - numeric_cast<V>(new_v)) * materials.rho[field[x][y]];
+                        force *= materials.damping[field[x][y]];
+                        if(!is_open(x, y, d))
+                            push = force * inv_dirs[dirs[x][y]];
+                        else
+                            push = force * inv_dirs[dirs[x + dx][y + dy]];
+                    }
+                    else {
+                        push = 0;
+                    }
+                });
+            });
         }
     }
+
+    // The kernels in kernels.h work on the raw storage of one IEEE type, so
+    // they are used only when p, velocity and velocity_flow share it. Rows on
+    // the grid border stay scalar: a vector load there could leave the arena.
+    static constexpr bool simd_types = is_same_v<P, V> && is_same_v<P, VFLOW>
+                                       && (is_same_v<P, Double> || is_same_v<P, Float>);
+    bool simd = false;
+
+    template <typename T>
+    static auto raw(T *ptr) {
+        using R = decltype(P::v);
+        static_assert(sizeof(P) == sizeof(R));
+        if constexpr(is_const_v<T>)
+            return reinterpret_cast<const R *>(ptr);
+        else
+            return reinterpret_cast<R *>(ptr);
+    }
+
+    // Same writes as the scalar row, direction by direction: each edge is
+    // still touched once, and every cell subtracts its shares from p in
+    // direction order.
+    P pressure_gradient_row_simd(size_t x) {
+        using R = decltype(P::v);
+        for(auto [y0, y1] : fluid_runs[x])
+            copy(old_p[x] + y0, old_p[x] + y1, p[x] + y0);
+        R total = 0;
+        for_each_live_run(x, x + 1, [&](size_t, int y0, int y1) {
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                size_t nx = x + deltas[d].first;
+                int dy = deltas[d].second;
+                GradientRow<R> g{raw(old_p[x]), raw(old_p[nx] + dy), open_dirs[x], field[x], field[nx] + dy,
+                                 dirs[x], raw(velocity.plane(d)[x]), raw(velocity.plane(opposite(d))[nx] + dy),
+                                 raw(p[x]), raw(materials.rho), raw(materials.inv_rho), raw(inv_dirs), unsigned(d)};
+                total += gradient_run(g, y0, y1);
+            }
+        });
+        return P(total);
+    }
+
+    void compute_flow_push_row_simd(size_t x) {
+        using R = decltype(P::v);
+        if(skip_tiles) {
+            for(auto [y0, y1] : fluid_runs[x]) {
+                for(size_t d = 0; d < deltas.size(); ++d)
+                    fill(flow_push.plane(d)[x] + y0, flow_push.plane(d)[x] + y1, P(0));
+            }
+        }
+        for_each_live_run(x, x + 1, [&](size_t, int y0, int y1) {
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                size_t nx = x + deltas[d].first;
+                int dy = deltas[d].second;
+                PushRow<R> q{raw(velocity.plane(d)[x]), raw(velocity_flow.plane(d)[x]), velocity_flow.stamp[x],
+                             velocity_flow.epoch, open_dirs[x], field[x], dirs[x], dirs[nx] + dy,
+                             raw(flow_push.plane(d)[x]), raw(materials.rho), raw(materials.damping), raw(inv_dirs),
+                             unsigned(d)};
+                push_run(q, y0, y1);
+            }
+        });
+    }
+
+    // Second half: each cell sums the pushes aimed at it in the same order the
+    // sequential sweep would have applied them, so p does not depend on the
+    // number of threads.
+    P gather_flow_push(size_t x0, size_t x1) {
+        P total = 0;
+        auto take = [&](size_t x, size_t y, P push) {
+            p[x][y] += push;
+            total += push;
+        };
+        for_each_fluid(x0, x1, [&](size_t x, size_t y) {
+            if(is_open(x, y, Up))
+                take(x, y, flow_push.template get<Down>(x - 1, y));
+            if(is_open(x, y, Left))
+                take(x, y, flow_push.template get<Right>(x, y - 1));
+            for(size_t d = 0; d < deltas.size(); ++d) {
+                if(!is_open(x, y, d))
+                    take(x, y, flow_push.get(x, y, d));
+            }
+            if(is_open(x, y, Right))
+                take(x, y, flow_push.template get<Left>(x, y + 1));
+            if(is_open(x, y, Down))
+                take(x, y, flow_push.template get<Up>(x + 1, y));
+        });
+        return total;
+    }
+
+    // Tick the next runSimulation starts from; restore() sets it.
+    size_t start_tick = 0;
+    unique_ptr<CheckpointWriter> checkpoints;
+
+    // Writes the header, the arena image and the scalar state as described
+    // in checkpoint.h. The image holds every field, derived ones included,
+    // exactly as the run had them after tick - 1; only the sparse tiles are
+    // rebuilt on load and restart all active.
+    void save_state(ByteWriter &w, uint64_t tick) {
+        CheckpointHeader h{};
+        memcpy(h.magic, CheckpointHeader::file_magic, sizeof(h.magic));
+        h.version = CheckpointHeader::file_version;
+        set_type_name(h.p_type, numeric_name<P>::get());
+        set_type_name(h.v_type, numeric_name<V>::get());
+        set_type_name(h.vf_type, numeric_name<VFLOW>::get());
+        h.n = uint32_t(N);
+        h.m = uint32_t(M);
+        h.tick = tick;
+        h.arena_offset = (sizeof(h) + Arena::alignment - 1) / Arena::alignment * Arena::alignment;
+        h.arena_size = arena.size();
+        h.state_offset = h.arena_offset + h.arena_size;
+
+        size_t start = w.out.size();
+        w.put(h);
+        w.out.resize(start + h.arena_offset, 0);
+        w.bytes(arena.data(), arena.size());
+
+        w.put(uint64_t(frame_count));
+        w.put(uint32_t(materials.count));
+        w.bytes(materials.id_of, sizeof(materials.id_of));
+        for(size_t id = 0; id < materials.count; ++id) {
+            w.put(materials.symbol[id]);
+            w.put(materials.rho[id]);
+            w.put(materials.damping[id]);
+            w.put(materials.is_wall[id]);
+        }
+        w.put(g);
+        w.put(velocity_flow.epoch);
+        w.put(visits.gen);
+        w.put(serial_walk.rng);
+        w.put(region_streams);
+        w.put(uint32_t(region_walks.size()));
+        for(auto &ctx : region_walks)
+            w.put(ctx.rng);
+
+        h.state_size = w.out.size() - start - h.state_offset;
+        memcpy(w.out.data() + start, &h, sizeof(h));
+    }
+
+    void load_state(ByteReader &r) {
+        frame_count = r.get<uint64_t>();
+        materials.count = r.get<uint32_t>();
+        r.bytes(materials.id_of, sizeof(materials.id_of));
+        for(size_t id = 0; id < materials.count; ++id) {
+            materials.symbol[id] = r.get<char>();
+            materials.rho[id] = r.get<P>();
+            materials.damping[id] = r.get<P>();
+            materials.is_wall[id] = r.get<uint8_t>();
+        }
+        g = r.get<P>();
+        velocity_flow.epoch = r.get<uint32_t>();
+        visits.gen = r.get<uint8_t>();
+
+        serial_walk.rng = r.get<Rng>();
+        Rng streams = r.get<Rng>();
+        uint32_t regions = r.get<uint32_t>();
+        region_walks.clear();
+        if(regions > 0) {
+            setup_regions();
+            if(regions != region_walks.size())
+                throw runtime_error("Checkpoint region layout does not match");
+            for(auto &ctx : region_walks)
+                ctx.rng = r.get<Rng>();
+        }
+        region_streams = streams;
+    }
+
+    // Snapshots the state into a free buffer and hands it to the writer
+    // thread; the run goes on while the file is written.
+    void checkpoint(uint64_t tick, const string &file_name) {
+        if(!checkpoints)
+            checkpoints = make_unique<CheckpointWriter>();
+        auto &buf = checkpoints->acquire();
+        ByteWriter w{buf};
+        save_state(w, tick);
+        checkpoints->submit(buf, file_name);
+    }
+
+    // Continues from a checkpoint written by checkpoint(): the fields are
+    // mapped copy-on-write straight from the file, so only the pages a run
+    // touches are read, and only the ones it writes are copied. The next
+    // runSimulation starts at the checkpoint's tick.
+    void restore(const string &file_name) {
+        auto h = read_checkpoint_header(file_name);
+        if(type_name(h.p_type) != numeric_name<P>::get() ||
+           type_name(h.v_type) != numeric_name<V>::get() ||
+           type_name(h.vf_type) != numeric_name<VFLOW>::get())
+            throw runtime_error("Checkpoint was written for other numeric types");
+        if(h.n != uint32_t(N) || h.m != uint32_t(M))
+            throw runtime_error("Checkpoint grid is " + to_string(h.n) + "x" + to_string(h.m));
+        Arena sizing;
+        bind_fields(sizing);
+        if(sizing.size() != h.arena_size)
+            throw runtime_error("Checkpoint field layout does not match this build");
+
+        arena.map(file_name, h.arena_offset, h.arena_size);
+        bind_fields(arena);
+        auto state = read_checkpoint_range(file_name, h.state_offset, h.state_size);
+        ByteReader r{state.data(), state.data() + state.size()};
+        load_state(r);
+        start_tick = h.tick;
+    }
+
+    // With save_interval > 0 a checkpoint of the state after every
+    // save_interval-th tick is written to file_name in the background.
+    void runSimulation(size_t T=500, size_t save_interval=0, const string &file_name="") {
+        if(materials.rho[MaterialTable::air_id] == 0 || inf == 0)
+            return;
+
+        reserve_stacks();
+        band_delta_p.assign(bands(), P(0));
+
+        rebuild_topology();
+        rebuild_reciprocals();
+        if(sparse)
+            setup_tiles();
+
+        for(size_t i = start_tick; i < T; ++i) {
+            P total_delta_p = 0;
+            for_each_live(0, N, [&](size_t x, size_t y) {
+                if(is_open(x, y, Down))
+                    velocity.template get<Down>(x, y) += g;
+            });
+
+            p.swap(old_p);
+            if(pool->size() > 1) {
+                pool->parallel_for(bands(), [&](size_t b) {
+                    band_delta_p[b] = pressure_gradient_rows(band_begin(b), band_end(b));
+                });
+                for(size_t b = 0; b < bands(); ++b)
+                    total_delta_p += band_delta_p[b];
+            }
+            else {
+                total_delta_p += pressure_gradient_rows(0, N);
+            }
+
+            velocity_flow.clear();
+            solve_flow();
+
+            if(pool->size() > 1 || simd) {
+                pool->parallel_for(bands(), [&](size_t b) {
+                    compute_flow_push(band_begin(b), band_end(b));
+                });
+                pool->parallel_for(bands(), [&](size_t b) {
+                    band_delta_p[b] = gather_flow_push(band_begin(b), band_end(b));
+                });
+                for(size_t b = 0; b < bands(); ++b)
+                    total_delta_p += band_delta_p[b];
+            }
+            else {
+                total_delta_p += apply_flow_rows(0, N);
+            }
+
+            next_generation();
+            bool prop = false;
+            if(parallel_move) {
+                prop = move_regions();
+            }
+            else {
+                for_each_live(0, N, [&](size_t x, size_t y) {
+                    move_cell(x, y, prop);
+                });
+            }
+
+            if(sparse)
+                update_tiles(i);
+
+            if(prop)
+                render_frame();
+            if(trajectory_out)
+                record_tick(i);
+            if(save_interval > 0 && !file_name.empty() && (i + 1) % save_interval == 0)
+                checkpoint(i + 1, file_name);
+        }
+        start_tick = 0;
+        frames->flush();
+        if(trajectory_out)
+            trajectory_out->flush();
+        if(checkpoints) {
+            checkpoints->wait();
+            if(checkpoints->failures() > 0)
+                cerr << checkpoints->failures() << " checkpoints could not be written to " << file_name << "\n";
+        }
+
+        if(verify_sparse)
+            cerr << "sparse verify: " << sparse_mismatches << " mismatching tiles over " << T << " ticks\n";
+        if(flow_worklist && flow_solver == FlowSolver::Reference)
+            cerr << "flow worklist: " << flow_passes << " passes, " << flow_visits << " cell visits, "
+                 << flow_sweep_visits - flow_visits << " saved against full sweeps\n";
+    }
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed-size pool that runs index ranges in parallel. The calling thread
+// takes part in every parallel_for, so a pool of size 1 owns no workers and
+// runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 1) {
+        if(threads == 0)
+            threads = 1;
+        for(size_t i = 1; i < threads; ++i)
+            workers.emplace_back([this] { worker_loop(); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool& operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            lock_guard lock(mtx);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for(auto &w : workers)
+            w.join();
+    }
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    // Calls f(i) for every i in [0, count) and returns once all calls are
+    // done. Which thread runs which index is unspecified, so f must only
+    // write state owned by index i.
+    template <typename F>
+    void parallel_for(size_t count, F &&f) {
+        if(workers.empty() || count <= 1) {
+            for(size_t i = 0; i < count; ++i)
+                f(i);
+            return;
+        }
+
+        {
+            lock_guard lock(mtx);
+            job = [&f](size_t i) { f(i); };
+            job_size = count;
+            next.store(0, memory_order_relaxed);
+            busy = workers.size();
+            ++generation;
+        }
+        start_cv.notify_all();
+
+        run_job();
+
+        unique_lock lock(mtx);
+        done_cv.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    void run_job() {
+        for(size_t i = next.fetch_add(1); i < job_size; i = next.fetch_add(1))
+            job(i);
+    }
+
+    void worker_loop() {
+        size_t seen = 0;
+        while(true) {
+            {
+                unique_lock lock(mtx);
+                start_cv.wait(lock, [&] { return stopping || generation != seen; });
+                if(stopping)
+                    return;
+                seen = generation;
+            }
+            run_job();
+            {
+                lock_guard lock(mtx);
+                if(--busy == 0)
+                    done_cv.notify_one();
+            }
+        }
+    }
+
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable start_cv;
+    condition_variable done_cv;
+    function<void(size_t)> job;
+    size_t job_size = 0;
+    atomic<size_t> next{0};
+    size_t busy = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Binary trajectory of a run. After a fixed header, every recorded tick is
+// one record:
+//
+//   u8 kind (0 keyframe, 1 delta) | u64 tick | u32 size | size payload bytes
+//
+// The state of a tick is the field symbols, then optionally p and the four
+// velocity planes as host-order doubles, each row-major. A delta payload is
+// the state XORed with the previous record's state and run-length encoded;
+// a keyframe is the same encoding against an all-zero state, so it decodes
+// on its own. Quiet regions XOR to zero runs, which is where the size goes.
+namespace trajectory {
+
+inline constexpr char magic[4] = {'F', 'L', 'T', 'R'};
+inline constexpr uint32_t version = 1;
+
+enum Planes : uint32_t {
+    Pressure = 1,
+    Velocity = 2
+};
+
+enum Kind : uint8_t {
+    Keyframe = 0,
+    Delta = 1
+};
+
+struct Header {
+    uint32_t n = 0;
+    uint32_t m = 0;
+    uint32_t planes = 0;
+    uint32_t keyframe_every = 0;
+
+    size_t cells() const {
+        return size_t(n) * m;
+    }
+
+    size_t state_size() const {
+        size_t size = cells();
+        if(planes & Pressure)
+            size += cells() * sizeof(double);
+        if(planes & Velocity)
+            size += 4 * cells() * sizeof(double);
+        return size;
+    }
+};
+
+inline void put_varint(vector<uint8_t> &out, size_t value) {
+    while(value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+inline size_t get_varint(const uint8_t *&in, const uint8_t *end) {
+    size_t value = 0;
+    for(int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t b = *in++;
+        value |= size_t(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return value;
+    }
+    throw runtime_error("Corrupt trajectory record");
+}
+
+// Encodes cur ^ prev (prev may be null for zeros) as alternating
+// (zero run, literal run) varint pairs, each literal followed by its bytes.
+// A literal ends where at least min_zeros zero bytes start.
+inline void encode(const uint8_t *cur, const uint8_t *prev, size_t size, vector<uint8_t> &out) {
+    constexpr size_t min_zeros = 4;
+    auto at = [&](size_t i) -> uint8_t {
+        return prev ? cur[i] ^ prev[i] : cur[i];
+    };
+    size_t i = 0;
+    while(i < size) {
+        size_t zeros = 0;
+        while(i + zeros < size && at(i + zeros) == 0)
+            ++zeros;
+        i += zeros;
+        size_t lit = 0;
+        for(size_t run = 0; i + lit < size; ++lit) {
+            run = at(i + lit) == 0 ? run + 1 : 0;
+            if(run == min_zeros) {
+                lit -= min_zeros - 1;
+                break;
+            }
+        }
+        put_varint(out, zeros);
+        put_varint(out, lit);
+        for(size_t k = 0; k < lit; ++k)
+            out.push_back(at(i + k));
+        i += lit;
+    }
+}
+
+// XORs a payload made by encode() into state.
+inline void apply(const uint8_t *in, size_t len, uint8_t *state, size_t size) {
+    const uint8_t *end = in + len;
+    size_t i = 0;
+    while(in < end) {
+        size_t zeros = get_varint(in, end);
+        size_t lit = get_varint(in, end);
+        if(i + zeros + lit > size || size_t(end - in) < lit)
+            throw runtime_error("Corrupt trajectory record");
+        i += zeros;
+        for(size_t k = 0; k < lit; ++k)
+            state[i++] ^= *in++;
+    }
+}
+
+// Appends one record per tick to a file. Records go through stdio's buffer,
+// so a run streams its trajectory without holding more than two states.
+class Writer {
+public:
+    Writer(const string &path, const Header &h) : header(h) {
+        file = fopen(path.c_str(), "wb");
+        if(!file)
+            throw runtime_error("Cannot open trajectory file: " + path);
+        fwrite(magic, 1, sizeof(magic), file);
+        uint32_t fields[5] = {version, h.n, h.m, h.planes, h.keyframe_every};
+        fwrite(fields, sizeof(uint32_t), 5, file);
+        prev.assign(h.state_size(), 0);
+    }
+
+    Writer(const Writer &) = delete;
+    Writer& operator=(const Writer &) = delete;
+
+    ~Writer() {
+        fclose(file);
+    }
+
+    const Header &format() const {
+        return header;
+    }
+
+    // state must hold header.state_size() bytes laid out as described above.
+    void record(uint64_t tick, const vector<uint8_t> &state) {
+        bool key = header.keyframe_every == 0 ? count == 0 : count % header.keyframe_every == 0;
+        payload.clear();
+        encode(state.data(), key ? nullptr : prev.data(), state.size(), payload);
+        uint8_t kind = key ? Keyframe : Delta;
+        uint32_t size = uint32_t(payload.size());
+        fwrite(&kind, 1, 1, file);
+        fwrite(&tick, sizeof(tick), 1, file);
+        fwrite(&size, sizeof(size), 1, file);
+        fwrite(payload.data(), 1, payload.size(), file);
+        prev = state;
+        ++count;
+    }
+
+    void flush() {
+        fflush(file);
+    }
+
+private:
+    Header header;
+    FILE *file = nullptr;
+    vector<uint8_t> prev;
+    vector<uint8_t> payload;
+    size_t count = 0;
+};
+
+// Reads a trajectory. Opening scans the record headers only, so seek() can
+// jump to the keyframe before any tick and decode forward from there.
+class Reader {
+public:
+    struct Entry {
+        uint64_t tick;
+        long offset;
+        uint32_t size;
+        Kind kind;
+    };
+
+    explicit Reader(const string &path) {
+        file = fopen(path.c_str(), "rb");
+        if(!file)
+            throw runtime_error("Cannot open trajectory file: " + path);
+        char m[4];
+        uint32_t fields[5];
+        if(fread(m, 1, 4, file) != 4 || memcmp(m, magic, 4) != 0 ||
+           fread(fields, sizeof(uint32_t), 5, file) != 5 || fields[0] != version)
+            throw runtime_error("Not a trajectory file: " + path);
+        header = {fields[1], fields[2], fields[3], fields[4]};
+        state.assign(header.state_size(), 0);
+        index_records();
+    }
+
+    Reader(const Reader &) = delete;
+    Reader& operator=(const Reader &) = delete;
+
+    ~Reader() {
+        fclose(file);
+    }
+
+    const Header &format() const {
+        return header;
+    }
+
+    const vector<Entry> &records() const {
+        return entries;
+    }
+
+    // Decodes record i; cheap when i follows the last decoded record.
+    void decode(size_t i) {
+        size_t from = i;
+        while(entries[from].kind != Keyframe)
+            --from;
+        if(decoded != npos && decoded >= from && decoded < i)
+            from = decoded + 1;
+        for(size_t k = from; k <= i; ++k) {
+            if(entries[k].kind == Keyframe)
+                fill(state.begin(), state.end(), 0);
+            payload.resize(entries[k].size);
+            fseek(file, entries[k].offset, SEEK_SET);
+            if(fread(payload.data(), 1, payload.size(), file) != payload.size())
+                throw runtime_error("Truncated trajectory record");
+            apply(payload.data(), payload.size(), state.data(), state.size());
+        }
+        decoded = i;
+    }
+
+    // Decodes the last record at or before tick; false if there is none.
+    bool seek(uint64_t tick) {
+        auto it = upper_bound(entries.begin(), entries.end(), tick,
+                              [](uint64_t t, const Entry &e) { return t < e.tick; });
+        if(it == entries.begin())
+            return false;
+        decode(size_t(it - entries.begin()) - 1);
+        return true;
+    }
+
+    uint64_t tick() const {
+        return entries[decoded].tick;
+    }
+
+    char symbol(size_t x, size_t y) const {
+        return char(state[x * header.m + y]);
+    }
+
+    double pressure(size_t x, size_t y) const {
+        return plane(header.cells(), x, y);
+    }
+
+    double velocity(size_t d, size_t x, size_t y) const {
+        size_t base = header.cells() * (header.planes & Pressure ? 1 + sizeof(double) : 1);
+        return plane(base + d * header.cells() * sizeof(double), x, y);
+    }
+
+private:
+    static constexpr size_t npos = size_t(-1);
+
+    double plane(size_t offset, size_t x, size_t y) const {
+        double value;
+        memcpy(&value, state.data() + offset + (x * header.m + y) * sizeof(double), sizeof(value));
+        return value;
+    }
+
+    void index_records() {
+        long start = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, start, SEEK_SET);
+        while(true) {
+            Entry e;
+            uint8_t kind;
+            if(fread(&kind, 1, 1, file) != 1)
+                break;
+            if(fread(&e.tick, sizeof(e.tick), 1, file) != 1 || fread(&e.size, sizeof(e.size), 1, file) != 1)
+                break;
+            e.kind = Kind(kind);
+            e.offset = ftell(file);
+            if(e.offset + long(e.size) > length || fseek(file, e.size, SEEK_CUR) != 0)
+                break;
+            if(entries.empty() && e.kind != Keyframe)
+                throw runtime_error("Trajectory does not start with a keyframe");
+            entries.push_back(e);
+        }
+    }
+
+    Header header;
+    FILE *file = nullptr;
+    vector<Entry> entries;
+    vector<uint8_t> state;
+    vector<uint8_t> payload;
+    size_t decoded = npos;
+};
+
+}